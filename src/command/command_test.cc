@@ -1,8 +1,45 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "../test_support/alloc_counter.h"
+
 struct walk {
   void operator()() {
     std::cout << "walk" << std::endl;
@@ -65,6 +102,301 @@ TEST(command, basic_test) {
   EXPECT_TRUE(oss.str() == act_output);
 }
 
+/**
+ * inplaceCommand is a move-only replacement for std::function<void()> that
+ * never allocates: the callable is stored in an inline buffer of `Capacity`
+ * bytes, and a callable that does not fit is a compile error rather than a
+ * silent heap allocation.
+ */
+template <size_t Capacity = 48>
+class inplaceCommand {
+public:
+  inplaceCommand() = default;
+
+  template <typename F,
+            typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, inplaceCommand>>>
+  inplaceCommand(F &&f) { // NOLINT: implicit like std::function
+    using Fn = std::decay_t<F>;
+    static_assert(sizeof(Fn) <= Capacity, "callable does not fit in inplaceCommand");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t), "callable is over-aligned");
+    static_assert(std::is_nothrow_move_constructible_v<Fn>, "callable must be nothrow movable");
+
+    ::new (static_cast<void *>(storage_)) Fn(std::forward<F>(f));
+    invoke_ = [](void *p) { (*static_cast<Fn *>(p))(); };
+    ops_ = &kOps<Fn>;
+  }
+
+  inplaceCommand(inplaceCommand &&other) noexcept : invoke_(other.invoke_), ops_(other.ops_) {
+    if (ops_)
+      ops_->relocate(storage_, other.storage_);
+    other.invoke_ = &noop;
+    other.ops_ = nullptr;
+  }
+
+  inplaceCommand &operator=(inplaceCommand &&other) noexcept {
+    if (this != &other) {
+      reset();
+      invoke_ = other.invoke_;
+      ops_ = other.ops_;
+      if (ops_)
+        ops_->relocate(storage_, other.storage_);
+      other.invoke_ = &noop;
+      other.ops_ = nullptr;
+    }
+    return *this;
+  }
+
+  inplaceCommand(const inplaceCommand &) = delete;
+  inplaceCommand &operator=(const inplaceCommand &) = delete;
+
+  ~inplaceCommand() { reset(); }
+
+  // Calling an empty command does nothing, like a null command object.
+  void operator()() { invoke_(storage_); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+private:
+  // The invoker is kept in the object itself so a call is a single indirect
+  // call; the rarely used operations live in a shared static table.
+  struct Ops {
+    void (*relocate)(void *dst, void *src); // move-construct dst, destroy src
+    void (*destroy)(void *);
+  };
+
+  template <typename Fn>
+  static constexpr Ops kOps = {
+      [](void *dst, void *src) {
+        ::new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+        static_cast<Fn *>(src)->~Fn();
+      },
+      [](void *p) { static_cast<Fn *>(p)->~Fn(); }};
+
+  static void noop(void *) {}
+
+  void reset() {
+    if (ops_)
+      ops_->destroy(storage_);
+    invoke_ = &noop;
+    ops_ = nullptr;
+  }
+
+  alignas(std::max_align_t) std::byte storage_[Capacity];
+  void (*invoke_)(void *) = &noop;
+  const Ops *ops_ = nullptr;
+};
+
+/**
+ * Like macroCommand, but the steps are packed back to back in one arena
+ * buffer. Each step takes exactly the size of its callable plus a pointer to
+ * its type's operations (rounded to 16 bytes), with no per-step heap block and
+ * no fixed-size slot. Once the arena is reserved, adding and running steps
+ * allocates nothing. Move-only, like the callables it holds.
+ */
+class inplaceMacroCommand {
+  static constexpr size_t kAlign = alignof(std::max_align_t);
+
+  static constexpr size_t roundUp(size_t n, size_t a) { return (n + a - 1) / a * a; }
+
+  struct Ops {
+    size_t (*invoke)(std::byte *record); // returns the stride
+    void (*relocate)(std::byte *dst, std::byte *src); // move the callable, destroy src
+    void (*destroy)(std::byte *record);
+    size_t stride;
+  };
+
+  // A record is [const Ops *][padding][Fn]; the callable sits at a fixed
+  // offset per type so the thunks below can find it.
+  template <typename Fn>
+  static constexpr size_t kOffset = roundUp(sizeof(const Ops *), alignof(Fn));
+
+  template <typename Fn>
+  static constexpr size_t kStride = roundUp(kOffset<Fn> + sizeof(Fn), kAlign);
+
+  template <typename Fn>
+  static Fn *object(std::byte *record) {
+    return std::launder(reinterpret_cast<Fn *>(record + kOffset<Fn>));
+  }
+
+  template <typename Fn>
+  static constexpr Ops kOps = {
+      [](std::byte *r) -> size_t {
+        (*object<Fn>(r))();
+        return kStride<Fn>;
+      },
+      [](std::byte *dst, std::byte *src) {
+        ::new (static_cast<void *>(dst + kOffset<Fn>)) Fn(std::move(*object<Fn>(src)));
+        object<Fn>(src)->~Fn();
+      },
+      [](std::byte *r) { object<Fn>(r)->~Fn(); },
+      kStride<Fn>};
+
+  static const Ops *ops(std::byte *record) { return *reinterpret_cast<const Ops **>(record); }
+
+public:
+  inplaceMacroCommand() = default;
+
+  inplaceMacroCommand(inplaceMacroCommand &&other) noexcept
+    : arena_(std::exchange(other.arena_, nullptr)), used_(std::exchange(other.used_, 0)),
+      capacity_(std::exchange(other.capacity_, 0)), steps_(std::exchange(other.steps_, 0)) {}
+
+  inplaceMacroCommand &operator=(inplaceMacroCommand &&other) noexcept {
+    if (this != &other) {
+      clear();
+      ::operator delete(arena_);
+      arena_ = std::exchange(other.arena_, nullptr);
+      used_ = std::exchange(other.used_, 0);
+      capacity_ = std::exchange(other.capacity_, 0);
+      steps_ = std::exchange(other.steps_, 0);
+    }
+    return *this;
+  }
+
+  ~inplaceMacroCommand() {
+    clear();
+    ::operator delete(arena_);
+  }
+
+  template <typename F>
+  void push_back(F &&f) {
+    using Fn = std::decay_t<F>;
+    static_assert(alignof(Fn) <= kAlign, "callable is over-aligned");
+    static_assert(std::is_nothrow_move_constructible_v<Fn>, "callable must be nothrow movable");
+
+    constexpr size_t stride = kStride<Fn>;
+    if (used_ + stride > capacity_)
+      reserve_bytes(std::max(capacity_ * 2, used_ + stride));
+
+    std::byte *record = arena_ + used_;
+    ::new (static_cast<void *>(record + kOffset<Fn>)) Fn(std::forward<F>(f));
+    *reinterpret_cast<const Ops **>(record) = &kOps<Fn>;
+    used_ += stride;
+    ++steps_;
+  }
+
+  // Grows the arena to hold at least `bytes`, relocating existing steps.
+  void reserve_bytes(size_t bytes) {
+    if (bytes <= capacity_)
+      return;
+    bytes = roundUp(bytes, kAlign);
+
+    auto *grown = static_cast<std::byte *>(::operator new(bytes));
+    for (size_t off = 0; off < used_;) {
+      const Ops *o = ops(arena_ + off);
+      *reinterpret_cast<const Ops **>(grown + off) = o;
+      o->relocate(grown + off, arena_ + off);
+      off += o->stride;
+    }
+    ::operator delete(arena_);
+    arena_ = grown;
+    capacity_ = bytes;
+  }
+
+  // The invoke thunk hands back the stride as an immediate, so finding the
+  // next step does not wait on a load from the Ops table.
+  void operator()() {
+    for (size_t off = 0; off < used_;)
+      off += ops(arena_ + off)->invoke(arena_ + off);
+  }
+
+  void clear() {
+    for (size_t off = 0; off < used_;) {
+      const Ops *o = ops(arena_ + off);
+      o->destroy(arena_ + off);
+      off += o->stride;
+    }
+    used_ = 0;
+    steps_ = 0;
+  }
+
+  [[nodiscard]] size_t size() const { return steps_; }
+  [[nodiscard]] size_t bytes() const { return used_; }
+
+private:
+  std::byte *arena_ = nullptr;
+  size_t used_ = 0;
+  size_t capacity_ = 0;
+  size_t steps_ = 0;
+};
+
+TEST(command, inplace_macro_test) {
+  std::stringstream oss;
+  testing::internal::CaptureStdout();
+
+  inplaceMacroCommand cardio_workout;
+  cardio_workout.push_back(walk{});
+  cardio_workout.push_back(jog{});
+  // A step can itself be a type-erased inplaceCommand.
+  cardio_workout.push_back(inplaceCommand<>{run{}});
+
+  // Empty and moved-from commands are harmless to call.
+  inplaceCommand<> empty;
+  EXPECT_FALSE(empty);
+  empty();
+  inplaceCommand<> step{walk{}};
+  auto taken = std::move(step);
+  EXPECT_FALSE(step);
+  step();
+
+  auto moved = std::move(cardio_workout);
+  EXPECT_EQ(moved.size(), 3u);
+  moved();
+
+  oss << "walk\n"
+         "jog\n"
+         "run\n";
+
+  EXPECT_EQ(oss.str(), testing::internal::GetCapturedStdout());
+}
+
+TEST(command, inplace_macro_benchmark) {
+  constexpr size_t steps = 1'000'000;
+
+  // Captures 24 bytes: too big for std::function's small buffer.
+  struct Step {
+    uint64_t *total;
+    uint64_t a, b;
+    void operator()() const { *total += a * b; }
+  };
+
+  uint64_t function_total = 0, inplace_total = 0;
+
+  size_t before = alloc_counter::allocations.load();
+  macroCommand function_macro;
+  function_macro.reserve(steps);
+  for (uint64_t i = 0; i < steps; ++i)
+    function_macro.push_back(Step{&function_total, i, 3});
+  size_t function_build_allocs = alloc_counter::allocations.load() - before;
+
+  before = alloc_counter::allocations.load();
+  inplaceMacroCommand inplace_macro;
+  inplace_macro.reserve_bytes(steps * 32);
+  for (uint64_t i = 0; i < steps; ++i)
+    inplace_macro.push_back(Step{&inplace_total, i, 3});
+  size_t inplace_build_allocs = alloc_counter::allocations.load() - before;
+
+  auto start = std::chrono::steady_clock::now();
+  function_macro();
+  auto function_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  before = alloc_counter::allocations.load();
+  start = std::chrono::steady_clock::now();
+  inplace_macro();
+  auto inplace_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  size_t inplace_run_allocs = alloc_counter::allocations.load() - before;
+
+  EXPECT_EQ(function_total, inplace_total);
+  EXPECT_EQ(inplace_macro.bytes(), steps * 32); // 8-byte header + 24-byte Step
+  EXPECT_EQ(inplace_build_allocs, 1u); // the reserve
+  EXPECT_EQ(inplace_run_allocs, 0u);
+
+  std::cout << steps << "-step macro command:\n"
+            << "  std::function: " << function_build_allocs << " allocations to build, "
+            << function_time.count() * 1e3 << " ms to run\n"
+            << "  inplaceMacroCommand: " << inplace_build_allocs << " allocations to build, "
+            << inplace_time.count() * 1e3 << " ms to run\n";
+}
+
 /**
  * The Command interface declares a method for executing a command.
  */
@@ -203,6 +535,343 @@ TEST(command, test1) {
   delete receiver;
 }
 
+namespace executor {
+/**
+ * CommandExecutor runs commands on dedicated worker threads. Any number of
+ * threads may post to it concurrently.
+ *
+ * The queue is a bounded lock-free ring (Vyukov's MPMC design): every slot
+ * carries a sequence number telling producers and consumers whether it is
+ * free or filled for the current lap, so neither side ever takes a lock. With
+ * one worker it behaves as an MPSC queue. Workers claim a whole batch of
+ * filled slots with a single CAS, then run them.
+ *
+ * An idle worker spins for `spin` rounds before parking on an atomic wait;
+ * producers only pay for a notify when some worker is actually parked.
+ *
+ * A command posted with post() that throws does not take the worker down:
+ * the exception is counted and the first one is kept for firstError().
+ */
+class CommandExecutor {
+public:
+  using Task = inplaceCommand<48>;
+
+  struct Options {
+    size_t workers = 1;
+    size_t capacity = 1 << 14; // power of two
+    size_t spin = 1 << 12;
+    size_t batch = 64;
+  };
+
+  explicit CommandExecutor(Options options)
+    : options_(options), mask_(options.capacity - 1), slots_(new Slot[options.capacity]) {
+    if (options.capacity == 0 || (options.capacity & mask_) != 0)
+      throw std::invalid_argument("CommandExecutor capacity must be a power of two");
+
+    for (size_t i = 0; i < options.capacity; ++i)
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    for (size_t i = 0; i < options.workers; ++i)
+      workers_.emplace_back([this] { run(); });
+  }
+
+  CommandExecutor() : CommandExecutor(Options{}) {}
+
+  CommandExecutor(const CommandExecutor &) = delete;
+  CommandExecutor &operator=(const CommandExecutor &) = delete;
+
+  // Runs everything already posted, then stops the workers.
+  ~CommandExecutor() {
+    stopping_.store(true);
+    wake_epoch_.fetch_add(1);
+    wake_epoch_.notify_all();
+    for (auto &t : workers_)
+      t.join();
+  }
+
+  // Enqueues `f` unless the ring is full. `f` is only moved from on success.
+  template <typename F, typename = std::enable_if_t<std::is_invocable_v<std::decay_t<F> &>>>
+  bool try_post(F &&f) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &slot = slots_[pos & mask_];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot.task = Task(std::forward<F>(f));
+          slot.seq.store(pos + 1, std::memory_order_release);
+          wake();
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // a full lap behind: the ring is full
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Enqueues `f`, yielding while the ring is full.
+  template <typename F, typename = std::enable_if_t<std::is_invocable_v<std::decay_t<F> &>>>
+  void post(F &&f) {
+    while (!try_post(std::forward<F>(f)))
+      std::this_thread::yield();
+  }
+
+  // Runs `command.Execute()` on a worker; the command must outlive that.
+  void post(const Command &command) {
+    post([&command] { command.Execute(); });
+  }
+
+  // Like post, but the future becomes ready once the command has run, and
+  // carries any exception it threw.
+  std::future<void> submit(const Command &command) {
+    std::promise<void> done;
+    auto result = done.get_future();
+    post([&command, done = std::move(done)]() mutable {
+      try {
+        command.Execute();
+        done.set_value();
+      } catch (...) {
+        done.set_exception(std::current_exception());
+      }
+    });
+    return result;
+  }
+
+  [[nodiscard]] size_t executed() const { return executed_.load(std::memory_order_acquire); }
+
+  // How many posted commands threw, and the first exception among them.
+  [[nodiscard]] size_t failed() const { return failed_.load(std::memory_order_acquire); }
+  [[nodiscard]] std::exception_ptr firstError() const {
+    std::lock_guard<std::mutex> lock(error_mutex_);
+    return first_error_;
+  }
+
+private:
+  struct alignas(64) Slot {
+    std::atomic<size_t> seq;
+    Task task;
+  };
+
+  static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  void run() {
+    size_t idle = 0;
+    for (;;) {
+      if (runBatch()) {
+        idle = 0;
+      } else if (stopping_.load()) {
+        if (!runBatch())
+          return;
+      } else if (++idle < options_.spin) {
+        cpuRelax();
+      } else {
+        park();
+        idle = 0;
+      }
+    }
+  }
+
+  // Claims up to `batch` consecutive filled slots with one CAS and runs them.
+  size_t runBatch() {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    size_t n;
+    for (;;) {
+      n = 0;
+      while (n < options_.batch &&
+             slots_[(pos + n) & mask_].seq.load(std::memory_order_acquire) == pos + n + 1)
+        ++n;
+
+      if (n == 0) {
+        size_t current = dequeue_pos_.load(std::memory_order_relaxed);
+        if (current == pos)
+          return 0;
+        pos = current;
+        continue;
+      }
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+        break;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      Slot &slot = slots_[(pos + i) & mask_];
+      Task task = std::move(slot.task);
+      // Hand the slot back to producers for the next lap before running.
+      slot.seq.store(pos + i + mask_ + 1, std::memory_order_release);
+      try {
+        task();
+      } catch (...) {
+        recordError(std::current_exception());
+      }
+    }
+    executed_.fetch_add(n, std::memory_order_release);
+    return n;
+  }
+
+  void recordError(std::exception_ptr error) {
+    {
+      std::lock_guard<std::mutex> lock(error_mutex_);
+      if (!first_error_)
+        first_error_ = std::move(error);
+    }
+    failed_.fetch_add(1, std::memory_order_release);
+  }
+
+  [[nodiscard]] bool empty() const {
+    size_t pos = dequeue_pos_.load();
+    return slots_[pos & mask_].seq.load(std::memory_order_acquire) != pos + 1;
+  }
+
+  void park() {
+    uint32_t epoch = wake_epoch_.load();
+    sleepers_.fetch_add(1);
+    // Re-check after announcing ourselves: a producer that enqueued before
+    // seeing sleepers_ > 0 did not notify.
+    if (empty() && !stopping_.load())
+      wake_epoch_.wait(epoch);
+    sleepers_.fetch_sub(1);
+  }
+
+  void wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) > 0) {
+      wake_epoch_.fetch_add(1);
+      wake_epoch_.notify_one();
+    }
+  }
+
+  const Options options_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  alignas(64) std::atomic<size_t> executed_{0};
+  std::atomic<uint32_t> wake_epoch_{0};
+  std::atomic<uint32_t> sleepers_{0};
+  std::atomic<bool> stopping_{false};
+
+  std::atomic<size_t> failed_{0};
+  mutable std::mutex error_mutex_;
+  std::exception_ptr first_error_;
+
+  std::vector<std::thread> workers_;
+};
+
+} // end of namespace executor
+
+TEST(command, executor_test) {
+  auto *receiver = new Receiver;
+  SimpleCommand hi{"Say Hi!"};
+  ComplexCommand report{receiver, "Send email", "Save report"};
+
+  struct Failing : Command {
+    void Execute() const override { throw std::runtime_error("failed"); }
+  } failing;
+
+  testing::internal::CaptureStdout();
+  {
+    executor::CommandExecutor ex({.workers = 2, .capacity = 8});
+    ex.submit(hi).get();
+    ex.submit(report).get();
+    EXPECT_THROW(ex.submit(failing).get(), std::runtime_error);
+
+    // Far more posts than the ring holds: producers wait for room.
+    std::atomic<int> counter{0};
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 4; ++p)
+      producers.emplace_back([&] {
+        for (int i = 0; i < 1000; ++i)
+          ex.post([&counter] { counter.fetch_add(1, std::memory_order_relaxed); });
+      });
+    for (auto &t : producers)
+      t.join();
+    while (ex.executed() < 4003)
+      std::this_thread::yield();
+    EXPECT_EQ(counter.load(), 4000);
+
+    // A throwing post() is recorded; the rest of its batch still runs.
+    EXPECT_EQ(ex.failed(), 0u);
+    ex.post([] { throw std::runtime_error("posted"); });
+    for (int i = 0; i < 16; ++i)
+      ex.post([&counter] { counter.fetch_add(1, std::memory_order_relaxed); });
+    while (ex.executed() < 4020)
+      std::this_thread::yield();
+    EXPECT_EQ(counter.load(), 4016);
+    EXPECT_EQ(ex.failed(), 1u);
+    EXPECT_THROW(std::rethrow_exception(ex.firstError()), std::runtime_error);
+  }
+
+  EXPECT_EQ(testing::internal::GetCapturedStdout(),
+            "SimpleCommand: See, I can do simple things like print (Say Hi!)\n"
+            "ComplexCommand: Complex stuff should be done by a receiver object.\n"
+            "Receiver: Working on (Send email)\n"
+            "Receiver: Also working on (Save report)\n");
+  delete receiver;
+}
+
+TEST(command, executor_benchmark) {
+  constexpr size_t producer_count = 2;
+  constexpr size_t per_producer = 1'000'000;
+  const size_t worker_count = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+  size_t total = producer_count * per_producer;
+  std::atomic<size_t> counter{0};
+  double throughput_seconds;
+  {
+    executor::CommandExecutor ex({.workers = worker_count});
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < producer_count; ++p)
+      producers.emplace_back([&] {
+        for (size_t i = 0; i < per_producer; ++i)
+          ex.post([&counter] { counter.fetch_add(1, std::memory_order_relaxed); });
+      });
+    for (auto &t : producers)
+      t.join();
+    while (ex.executed() < total)
+      std::this_thread::yield();
+    throughput_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  EXPECT_EQ(counter.load(), total);
+
+  // Enqueue-to-execute latency, posting in short bursts so the measurement
+  // is of the handoff rather than of an ever-growing backlog.
+  constexpr size_t samples = 100'000;
+  constexpr size_t burst = 16;
+  std::vector<int64_t> latency_ns(samples);
+  {
+    executor::CommandExecutor ex({.workers = worker_count});
+    for (size_t i = 0; i < samples; ++i) {
+      auto posted = std::chrono::steady_clock::now();
+      ex.post([posted, slot = &latency_ns[i]] {
+        *slot = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - posted).count();
+      });
+      if (i % burst == burst - 1)
+        while (ex.executed() <= i)
+          std::this_thread::yield();
+    }
+    while (ex.executed() < samples)
+      std::this_thread::yield();
+  }
+  std::sort(latency_ns.begin(), latency_ns.end());
+
+  std::cout << "command executor, " << producer_count << " producers / " << worker_count
+            << " workers: " << total / throughput_seconds / 1e6 << " M commands/s\n"
+            << "  enqueue-to-execute latency: p50 " << latency_ns[samples / 2] << " ns, p99 "
+            << latency_ns[samples * 99 / 100] << " ns\n";
+}
+
 namespace demo2 {
 struct BankAccount {
   int32_t balance_;
@@ -235,9 +904,102 @@ struct BankAccountCommand : Command {
     (m_action == Action::deposit) ? m_ac.withdraw(m_amount)
                                   : m_ac.deposit(m_amount);
   }
+
+  // Like execute, but refuses, leaving the account untouched, when a
+  // withdrawal would overdraw the account or a deposit would overflow it.
+  // A negative amount is always refused: it would turn one into the other
+  // and slip past both checks.
+  bool try_execute() {
+    int32_t result;
+    bool refused = m_amount < 0 ||
+                   ((m_action == Action::deposit)
+                        ? __builtin_add_overflow(m_ac.balance_, m_amount, &result)
+                        : m_ac.balance_ < m_amount);
+    if (refused)
+      return false;
+    execute();
+    return true;
+  }
+};
+
+/**
+ * A fixed set of threads that runs one phase at a time: `run(fn)` calls
+ * fn(lane) for every lane in [0, size()), lane 0 on the calling thread, and
+ * returns once every lane is done. The threads are started once and reused
+ * for every phase, so a multi-phase job pays for thread creation only once.
+ */
+class LanePool {
+public:
+  explicit LanePool(size_t lanes) : lanes_(lanes ? lanes : 1) {
+    for (size_t l = 1; l < lanes_; ++l)
+      workers_.emplace_back([this, l] { work(l); });
+  }
+
+  LanePool(const LanePool &) = delete;
+  LanePool &operator=(const LanePool &) = delete;
+
+  ~LanePool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      ++generation_;
+    }
+    start_.notify_all();
+    for (auto &w : workers_)
+      w.join();
+  }
+
+  [[nodiscard]] size_t size() const { return lanes_; }
+
+  template <typename Fn>
+  void run(const Fn &fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      phase_ = &fn;
+      call_ = [](const void *f, size_t lane) { (*static_cast<const Fn *>(f))(lane); };
+      remaining_ = lanes_ - 1;
+      ++generation_;
+    }
+    start_.notify_all();
+    fn(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return remaining_ == 0; });
+  }
+
+private:
+  void work(size_t lane) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      start_.wait(lock, [&] { return generation_ != seen; });
+      seen = generation_;
+      if (stopping_)
+        return;
+
+      const void *phase = phase_;
+      auto call = call_;
+      lock.unlock();
+      call(phase, lane);
+      lock.lock();
+      if (--remaining_ == 0)
+        done_.notify_one();
+    }
+  }
+
+  const size_t lanes_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_, done_;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+  const void *phase_ = nullptr;
+  void (*call_)(const void *, size_t) = nullptr;
+  size_t remaining_ = 0;
 };
 
 struct CompositeBankAccountCommand : std::vector<BankAccountCommand>, Command {
+  CompositeBankAccountCommand() = default;
   CompositeBankAccountCommand(const std::initializer_list<value_type> &items)
       : std::vector<BankAccountCommand>(items) {}
 
@@ -251,6 +1013,103 @@ struct CompositeBankAccountCommand : std::vector<BankAccountCommand>, Command {
     for (auto &cmd : *this)
       cmd.undo();
   }
+
+  /**
+   * All or nothing: runs the commands in order and, if one is refused, undoes
+   * the ones that already ran and returns false.
+   */
+  bool try_execute() {
+    for (auto it = begin(); it != end(); ++it) {
+      if (!it->try_execute()) {
+        while (it != begin())
+          (--it)->undo();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * All or nothing, on `threads` threads. Each command goes to a lane chosen
+   * by the account it touches, so every account belongs to exactly one lane:
+   * lanes never conflict, and within a lane commands keep their batch order.
+   * The split itself is a parallel counting partition (count per chunk, then
+   * scatter), so no pass over the batch is serial. When any command is
+   * refused, every lane stops and undoes, newest first, exactly the commands
+   * it had already run.
+   */
+  bool try_execute_parallel(size_t threads) {
+    if (threads <= 1)
+      return try_execute();
+    if (size() > UINT32_MAX)
+      throw std::length_error("batch too large for try_execute_parallel");
+
+    const size_t n = size();
+    const size_t chunk = (n + threads - 1) / threads;
+    auto lane = [threads](const BankAccountCommand &cmd) {
+      auto key = reinterpret_cast<uintptr_t>(&cmd.m_ac) / alignof(BankAccount);
+      auto hash = static_cast<uint32_t>((key * 0x9e3779b97f4a7c15ull) >> 32);
+      return static_cast<size_t>((uint64_t{hash} * threads) >> 32);
+    };
+
+    // One set of threads for all four phases below.
+    LanePool lanes(threads);
+
+    // counts[c * threads + l]: commands of chunk c that belong to lane l,
+    // turned into that group's output position by the prefix sum below.
+    std::vector<size_t> counts(threads * threads, 0);
+    lanes.run([&](size_t c) {
+      std::vector<size_t> local(threads, 0);
+      for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+        ++local[lane((*this)[i])];
+      std::copy(local.begin(), local.end(), counts.begin() + c * threads);
+    });
+
+    std::vector<size_t> lane_begin(threads + 1, 0);
+    for (size_t l = 0, pos = 0; l < threads; ++l) {
+      lane_begin[l] = pos;
+      for (size_t c = 0; c < threads; ++c)
+        pos += std::exchange(counts[c * threads + l], pos);
+    }
+    lane_begin[threads] = n;
+
+    // Batch indices grouped by lane; left uninitialized, every slot is
+    // written by the scatter.
+    std::unique_ptr<uint32_t[]> order(new uint32_t[n]);
+    lanes.run([&](size_t c) {
+      std::vector<size_t> next(counts.begin() + c * threads, counts.begin() + (c + 1) * threads);
+      for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+        order[next[lane((*this)[i])]++] = static_cast<uint32_t>(i);
+    });
+
+    std::atomic<bool> refused{false};
+    std::vector<size_t> ran(threads, 0);
+    lanes.run([&](size_t l) {
+      size_t i = lane_begin[l];
+      for (; i < lane_begin[l + 1]; ++i) {
+        if (!(*this)[order[i]].try_execute()) {
+          refused.store(true, std::memory_order_relaxed);
+          break;
+        }
+        // Poll the other lanes only now and then; a late stop just means
+        // a little more to undo.
+        if ((i & 1023) == 0 && refused.load(std::memory_order_relaxed)) {
+          ++i;
+          break;
+        }
+      }
+      ran[l] = i - lane_begin[l];
+    });
+
+    if (!refused.load())
+      return true;
+
+    lanes.run([&](size_t l) {
+      for (size_t i = lane_begin[l] + ran[l]; i > lane_begin[l]; --i)
+        (*this)[order[i - 1]].undo();
+    });
+    return false;
+  }
 };
 
 } // end of namespace demo2
@@ -274,3 +1133,1905 @@ TEST(command, demo2){
   std::cout << ba1.balance_ << std::endl;
   std::cout << ba2.balance_ << std::endl;
 }
+
+TEST(command, composite_parallel_test) {
+  using demo2::BankAccountCommand;
+  using Action = BankAccountCommand::Action;
+
+  std::vector<demo2::BankAccount> accounts(64, demo2::BankAccount{100});
+
+  demo2::CompositeBankAccountCommand batch;
+  for (size_t round = 0; round < 10; ++round)
+    for (auto &a : accounts) {
+      batch.emplace_back(a, Action::withdraw, 10);
+      batch.emplace_back(a, Action::deposit, 5);
+    }
+
+  // Net -50 per account: succeeds, and in-lane order keeps every
+  // intermediate balance non-negative.
+  EXPECT_TRUE(batch.try_execute_parallel(4));
+  for (auto &a : accounts)
+    EXPECT_EQ(a.balance_, 50);
+
+  // One account cannot cover its last withdrawal: nothing may stick.
+  batch.emplace_back(accounts[17], Action::withdraw, 1000);
+  EXPECT_FALSE(batch.try_execute_parallel(4));
+  for (auto &a : accounts)
+    EXPECT_EQ(a.balance_, 50);
+
+  EXPECT_FALSE(batch.try_execute());
+  for (auto &a : accounts)
+    EXPECT_EQ(a.balance_, 50);
+
+  // A negative deposit is a disguised withdrawal, and is refused as such.
+  demo2::BankAccountCommand sneaky{accounts[3], Action::deposit, -1000};
+  EXPECT_FALSE(sneaky.try_execute());
+  demo2::BankAccountCommand sneaky_withdraw{accounts[3], Action::withdraw, INT32_MIN};
+  EXPECT_FALSE(sneaky_withdraw.try_execute());
+  EXPECT_EQ(accounts[3].balance_, 50);
+}
+
+TEST(command, composite_parallel_benchmark) {
+  using demo2::BankAccountCommand;
+  using Action = BankAccountCommand::Action;
+
+  constexpr size_t account_count = 100'000;
+  constexpr size_t command_count = 4'000'000;
+
+  std::vector<demo2::BankAccount> accounts(account_count, demo2::BankAccount{1'000'000});
+  std::mt19937 rng(11);
+  demo2::CompositeBankAccountCommand batch;
+  batch.reserve(command_count);
+  for (size_t i = 0; i < command_count; ++i)
+    batch.emplace_back(accounts[rng() % account_count],
+                       (i & 1) ? Action::deposit : Action::withdraw,
+                       static_cast<int32_t>(rng() % 100));
+
+  std::cout << command_count << " commands over " << account_count << " accounts:\n";
+  for (size_t threads : {1u, 2u, 4u, std::max(1u, std::thread::hardware_concurrency())}) {
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(batch.try_execute_parallel(threads));
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    batch.undo();
+
+    std::cout << "  " << threads << " thread(s): " << elapsed.count() * 1e3 << " ms ("
+              << command_count / elapsed.count() / 1e6 << " M commands/s)\n";
+  }
+
+  for (auto &a : accounts)
+    EXPECT_EQ(a.balance_, 1'000'000);
+}
+
+namespace demo2 {
+/**
+ * JournaledBank owns a set of BankAccounts and makes every command executed
+ * through it durable. Each command is appended to a binary write-ahead log
+ * before `commit` returns; on construction the log is replayed on top of the
+ * latest snapshot to restore the balances.
+ *
+ * Group commit: a committing thread that finds no flush in progress becomes
+ * the leader, writes everything queued so far and issues one fdatasync for
+ * all of it, while later committers queue up behind it for the next flush.
+ * Every `snapshot_every` records the leader writes a snapshot of all balances
+ * and truncates the log, so replay only ever covers a bounded tail.
+ *
+ * Balances only change once a record is durable: the leader applies a batch
+ * after its fdatasync succeeds. A failed write or sync poisons the bank; the
+ * commits in flight and every later one throw, since what reached the disk
+ * is unknown.
+ */
+class JournaledBank {
+public:
+  struct Options {
+    bool group_commit = true;       // false: one fdatasync per command
+    uint64_t snapshot_every = 100'000; // records between snapshots, 0 = never
+  };
+
+  JournaledBank(const std::filesystem::path &dir, size_t account_count, Options options)
+    : options_(options), accounts_(account_count, BankAccount{0}),
+      wal_path_(dir / "bank.wal"), snapshot_path_(dir / "bank.snapshot") {
+    std::filesystem::create_directories(dir);
+    loadSnapshot();
+
+    fd_ = ::open(wal_path_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0)
+      throw std::system_error(errno, std::generic_category(), "open " + wal_path_.string());
+    replayLog();
+  }
+
+  JournaledBank(const std::filesystem::path &dir, size_t account_count)
+    : JournaledBank(dir, account_count, Options{}) {}
+
+  JournaledBank(const JournaledBank &) = delete;
+  JournaledBank &operator=(const JournaledBank &) = delete;
+
+  ~JournaledBank() { ::close(fd_); }
+
+  // Commands committed through this bank must target these accounts.
+  BankAccount &account(size_t id) { return accounts_[id]; }
+  [[nodiscard]] size_t size() const { return accounts_.size(); }
+
+  // Executes `command` once it is durable in the log, then returns.
+  void commit(BankAccountCommand &command) { append(command, command.m_action); }
+
+  // Undoes `command`, journaled as the inverse action.
+  void commitUndo(BankAccountCommand &command) {
+    auto inverse = command.m_action == BankAccountCommand::Action::deposit
+                       ? BankAccountCommand::Action::withdraw
+                       : BankAccountCommand::Action::deposit;
+    append(command, inverse);
+  }
+
+  // Writes a snapshot of every balance and empties the log.
+  void checkpoint() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushed_.wait(lock, [this] { return !flushing_ || failure_; });
+    throwIfFailed();
+    flushPending(lock);
+    writeSnapshot(lock);
+  }
+
+  [[nodiscard]] uint64_t lsn() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_lsn_;
+  }
+
+  [[nodiscard]] uint64_t syncs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return syncs_;
+  }
+
+private:
+  struct Record {
+    uint64_t lsn;
+    uint32_t account;
+    int32_t amount;
+    uint8_t action;
+    uint8_t pad[3];
+    uint32_t checksum; // over every byte before it
+  };
+  static_assert(sizeof(Record) == 24 && std::is_trivially_copyable_v<Record>);
+
+  struct SnapshotHeader {
+    uint64_t magic;
+    uint64_t lsn;
+    uint64_t account_count;
+  };
+  static constexpr uint64_t kSnapshotMagic = 0x314b4e4142534e53; // "SNSBANK1"
+
+  static uint32_t checksum(const Record &r) {
+    uint32_t h = 2166136261u; // FNV-1a
+    auto *bytes = reinterpret_cast<const unsigned char *>(&r);
+    for (size_t i = 0; i < offsetof(Record, checksum); ++i)
+      h = (h ^ bytes[i]) * 16777619u;
+    return h;
+  }
+
+  void append(BankAccountCommand &command, BankAccountCommand::Action action) {
+    auto id = static_cast<size_t>(&command.m_ac - accounts_.data());
+    if (id >= accounts_.size())
+      throw std::invalid_argument("command does not target an account of this bank");
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    throwIfFailed();
+    Record r{++next_lsn_, static_cast<uint32_t>(id), command.m_amount,
+             static_cast<uint8_t>(action), {}, 0};
+    r.checksum = checksum(r);
+    pending_.append(reinterpret_cast<const char *>(&r), sizeof(r));
+
+    if (!options_.group_commit) {
+      // The baseline: this command's own write and sync, fully serialized.
+      try {
+        writeAll(pending_);
+        sync(fd_, wal_path_);
+      } catch (...) {
+        failure_ = std::current_exception();
+        throw;
+      }
+      applyRecords(pending_);
+      pending_.clear();
+      durable_lsn_ = r.lsn;
+      ++syncs_;
+    } else {
+      while (durable_lsn_ < r.lsn) {
+        throwIfFailed();
+        if (flushing_)
+          flushed_.wait(lock);
+        else
+          flushPending(lock);
+      }
+    }
+
+    if (options_.snapshot_every && next_lsn_ - snapshot_lsn_ >= options_.snapshot_every &&
+        !flushing_) {
+      flushPending(lock);
+      writeSnapshot(lock);
+    }
+  }
+
+  // Writes and syncs everything queued. Drops the lock during the I/O, so
+  // other threads keep queueing records for the next flush meanwhile.
+  void flushPending(std::unique_lock<std::mutex> &lock) {
+    if (pending_.empty())
+      return;
+
+    std::string batch;
+    batch.swap(pending_);
+    uint64_t upto = next_lsn_;
+    flushing_ = true;
+    lock.unlock();
+
+    try {
+      writeAll(batch);
+      sync(fd_, wal_path_);
+    } catch (...) {
+      // Wake the followers so they see the failure instead of waiting for
+      // a flush that will never come.
+      lock.lock();
+      flushing_ = false;
+      failure_ = std::current_exception();
+      flushed_.notify_all();
+      throw;
+    }
+
+    lock.lock();
+    applyRecords(batch);
+    flushing_ = false;
+    durable_lsn_ = upto;
+    ++syncs_;
+    flushed_.notify_all();
+  }
+
+  // Applies durable records in log order, exactly as replay would.
+  void applyRecords(std::string_view batch) {
+    for (size_t off = 0; off < batch.size(); off += sizeof(Record)) {
+      Record r;
+      std::memcpy(&r, batch.data() + off, sizeof(r));
+      BankAccountCommand{accounts_[r.account], static_cast<BankAccountCommand::Action>(r.action),
+                         r.amount}.execute();
+    }
+  }
+
+  void throwIfFailed() const {
+    if (failure_)
+      std::rethrow_exception(failure_);
+  }
+
+  static void sync(int fd, const std::filesystem::path &path) {
+    if (::fdatasync(fd) < 0)
+      throw std::system_error(errno, std::generic_category(), "fdatasync " + path.string());
+  }
+
+  void writeAll(std::string_view data) {
+    while (!data.empty()) {
+      ssize_t n = ::write(fd_, data.data(), data.size());
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::system_error(errno, std::generic_category(), "write " + wal_path_.string());
+      }
+      data.remove_prefix(static_cast<size_t>(n));
+    }
+  }
+
+  // Called with the lock held and no flush running, so every balance reflects
+  // exactly the records up to durable_lsn_. Only the copy of the balances
+  // happens under the lock; the snapshot marks itself as the running flush
+  // for the I/O, so commits keep queueing records meanwhile but none reaches
+  // the log before the truncate.
+  void writeSnapshot(std::unique_lock<std::mutex> &lock) {
+    SnapshotHeader header{kSnapshotMagic, durable_lsn_, accounts_.size()};
+    std::string image(reinterpret_cast<const char *>(&header), sizeof(header));
+    image.reserve(sizeof(header) + accounts_.size() * sizeof(BankAccount::balance_));
+    for (const auto &a : accounts_)
+      image.append(reinterpret_cast<const char *>(&a.balance_), sizeof(a.balance_));
+    flushing_ = true;
+    lock.unlock();
+
+    bool log_intact = true;
+    try {
+      writeSnapshotFile(image);
+
+      // Once the snapshot is durable the log is redundant. A crash before
+      // the truncate is harmless: replay skips records the snapshot covers.
+      log_intact = false;
+      if (::ftruncate(fd_, 0) < 0)
+        throw std::system_error(errno, std::generic_category(), "ftruncate " + wal_path_.string());
+      sync(fd_, wal_path_);
+    } catch (...) {
+      // A snapshot that never got written leaves the bank as it was; one
+      // that failed half way through emptying the log does not.
+      lock.lock();
+      flushing_ = false;
+      if (!log_intact)
+        failure_ = std::current_exception();
+      flushed_.notify_all();
+      throw;
+    }
+
+    lock.lock();
+    flushing_ = false;
+    snapshot_lsn_ = header.lsn;
+    flushed_.notify_all();
+  }
+
+  // Writes `image` to a temporary file and renames it over the snapshot,
+  // durably, directory entry included.
+  void writeSnapshotFile(std::string_view image) const {
+    auto tmp = snapshot_path_;
+    tmp += ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "open " + tmp.string());
+    while (!image.empty()) {
+      ssize_t n = ::write(fd, image.data(), image.size());
+      if (n < 0 && errno != EINTR) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "write " + tmp.string());
+      }
+      if (n > 0)
+        image.remove_prefix(static_cast<size_t>(n));
+    }
+    if (::fdatasync(fd) < 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "fdatasync " + tmp.string());
+    }
+    ::close(fd);
+
+    std::filesystem::rename(tmp, snapshot_path_);
+    int dir = ::open(snapshot_path_.parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "open " + snapshot_path_.parent_path().string());
+    int rc = ::fsync(dir);
+    int err = errno;
+    ::close(dir);
+    if (rc < 0)
+      throw std::system_error(err, std::generic_category(),
+                              "fsync " + snapshot_path_.parent_path().string());
+  }
+
+  void loadSnapshot() {
+    std::ifstream in(snapshot_path_, std::ios::binary);
+    SnapshotHeader header{};
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+      return;
+    if (header.magic != kSnapshotMagic || header.account_count != accounts_.size())
+      throw std::runtime_error("snapshot does not match this bank");
+
+    for (auto &a : accounts_)
+      in.read(reinterpret_cast<char *>(&a.balance_), sizeof(a.balance_));
+    if (!in)
+      throw std::runtime_error("truncated snapshot");
+    snapshot_lsn_ = next_lsn_ = durable_lsn_ = header.lsn;
+  }
+
+  // Re-applies every intact record newer than the snapshot, and cuts off a
+  // torn tail left by a crash in the middle of a write.
+  void replayLog() {
+    std::ifstream in(wal_path_, std::ios::binary);
+    Record r{};
+    off_t valid = 0;
+    while (in.read(reinterpret_cast<char *>(&r), sizeof(r))) {
+      if (r.checksum != checksum(r) || r.account >= accounts_.size())
+        break;
+      if (r.lsn > snapshot_lsn_) {
+        BankAccountCommand{accounts_[r.account], static_cast<BankAccountCommand::Action>(r.action),
+                           r.amount}.execute();
+        next_lsn_ = durable_lsn_ = r.lsn;
+      }
+      valid += static_cast<off_t>(sizeof(r));
+    }
+
+    if (valid != static_cast<off_t>(std::filesystem::file_size(wal_path_)) &&
+        ::ftruncate(fd_, valid) < 0)
+      throw std::system_error(errno, std::generic_category(), "ftruncate " + wal_path_.string());
+  }
+
+  const Options options_;
+  std::vector<BankAccount> accounts_;
+  std::filesystem::path wal_path_, snapshot_path_;
+  int fd_ = -1;
+
+  mutable std::mutex mutex_;
+  std::condition_variable flushed_;
+  std::string pending_;
+  bool flushing_ = false;
+  std::exception_ptr failure_; // set once a write or sync of the log fails
+  uint64_t next_lsn_ = 0;
+  uint64_t durable_lsn_ = 0;
+  uint64_t snapshot_lsn_ = 0;
+  uint64_t syncs_ = 0;
+};
+
+} // end of namespace demo2
+
+TEST(command, journaled_bank_test) {
+  using Action = demo2::BankAccountCommand::Action;
+  auto dir = std::filesystem::temp_directory_path() / "command_journaled_bank_test";
+  std::filesystem::remove_all(dir);
+
+  {
+    demo2::JournaledBank bank(dir, 2);
+    demo2::BankAccountCommand open1{bank.account(0), Action::deposit, 1000};
+    demo2::BankAccountCommand open2{bank.account(1), Action::deposit, 1000};
+    demo2::BankAccountCommand move{bank.account(0), Action::withdraw, 200};
+    bank.commit(open1);
+    bank.commit(open2);
+    bank.commit(move);
+    bank.commitUndo(move);
+    bank.commit(move);
+  }
+
+  {
+    // Replay from the log alone.
+    demo2::JournaledBank bank(dir, 2);
+    EXPECT_EQ(bank.account(0).balance_, 800);
+    EXPECT_EQ(bank.account(1).balance_, 1000);
+    EXPECT_EQ(bank.lsn(), 5u);
+
+    bank.checkpoint();
+    demo2::BankAccountCommand pay{bank.account(1), Action::deposit, 50};
+    bank.commit(pay);
+  }
+
+  // A crash halfway through appending a record leaves a torn tail.
+  std::ofstream(dir / "bank.wal", std::ios::binary | std::ios::app) << "torn";
+
+  {
+    // Snapshot plus the tail of the log; the torn bytes are discarded.
+    demo2::JournaledBank bank(dir, 2);
+    EXPECT_EQ(bank.account(0).balance_, 800);
+    EXPECT_EQ(bank.account(1).balance_, 1050);
+    EXPECT_EQ(bank.lsn(), 6u);
+    EXPECT_EQ(std::filesystem::file_size(dir / "bank.wal"), 24u);
+  }
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST(command, journaled_bank_snapshot_under_load) {
+  using Action = demo2::BankAccountCommand::Action;
+  auto dir = std::filesystem::temp_directory_path() / "command_journaled_bank_snapshot";
+  std::filesystem::remove_all(dir);
+
+  constexpr size_t thread_count = 4;
+  constexpr int per_thread = 200;
+  {
+    // Snapshots every few records, while other threads keep committing.
+    demo2::JournaledBank bank(dir, thread_count, {.group_commit = true, .snapshot_every = 16});
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&bank, t] {
+        demo2::BankAccountCommand deposit{bank.account(t), Action::deposit, 1};
+        for (int i = 0; i < per_thread; ++i)
+          bank.commit(deposit);
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+    EXPECT_EQ(bank.lsn(), thread_count * per_thread);
+  }
+
+  // Whatever the last snapshot covers, snapshot plus log adds up.
+  demo2::JournaledBank bank(dir, thread_count);
+  for (size_t t = 0; t < thread_count; ++t)
+    EXPECT_EQ(bank.account(t).balance_, per_thread);
+  EXPECT_EQ(bank.lsn(), thread_count * per_thread);
+  EXPECT_LT(std::filesystem::file_size(dir / "bank.wal"), thread_count * per_thread * 24u);
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST(command, journaled_bank_benchmark) {
+  using Action = demo2::BankAccountCommand::Action;
+  constexpr size_t thread_count = 8;
+  constexpr size_t per_thread = 200;
+
+  auto run = [](bool group_commit) {
+    auto dir = std::filesystem::temp_directory_path() / "command_journaled_bank_bench";
+    std::filesystem::remove_all(dir);
+    demo2::JournaledBank bank(dir, thread_count, {.group_commit = group_commit});
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t)
+      threads.emplace_back([&bank, t] {
+        demo2::BankAccountCommand deposit{bank.account(t), Action::deposit, 1};
+        for (size_t i = 0; i < per_thread; ++i)
+          bank.commit(deposit);
+      });
+    for (auto &th : threads)
+      th.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+    for (size_t t = 0; t < thread_count; ++t)
+      EXPECT_EQ(bank.account(t).balance_, static_cast<int32_t>(per_thread));
+    auto syncs = bank.syncs();
+    std::filesystem::remove_all(dir);
+    return std::pair{elapsed.count(), syncs};
+  };
+
+  auto [single_time, single_syncs] = run(false);
+  auto [group_time, group_syncs] = run(true);
+
+  size_t total = thread_count * per_thread;
+  std::cout << total << " journaled commits from " << thread_count << " threads:\n"
+            << "  fdatasync per command: " << total / single_time << " commits/s, "
+            << single_syncs << " syncs\n"
+            << "  group commit: " << total / group_time << " commits/s, "
+            << group_syncs << " syncs\n";
+}
+
+namespace demo2 {
+/**
+ * Ledger keeps the balances of millions of accounts for bulk processing,
+ * where a BankAccount object per account (and a reference per command) would
+ * not scale. Balances are 64-bit and stored as one contiguous, cache-line
+ * aligned array, split into shards of whole cache lines. Batches are applied
+ * with one thread per shard, and each account is only ever written by its
+ * shard's thread: even a hot account's cache line never bounces between
+ * cores, and no two shards share a line.
+ *
+ * Every operation is checked: a withdrawal that would take the balance below
+ * zero, an operation that would overflow, or one naming an account the
+ * ledger does not have is rejected, leaves the balances unchanged, and is
+ * reported in the per-operation status.
+ *
+ * The shard threads are started once, with the ledger. A ledger applies one
+ * batch at a time; callers serialize apply() and applyDense().
+ */
+class Ledger {
+public:
+  enum class Status : uint8_t { ok, insufficient_funds, overflow, unknown_account };
+
+  // A batch of deposits and withdrawals in column form.
+  struct Batch {
+    std::vector<uint32_t> accounts;
+    std::vector<int64_t> deltas; // deposits positive, withdrawals negative
+
+    // Amounts are non-negative; that also keeps -amount representable.
+    void deposit(uint32_t account, int64_t amount) { append(account, checkAmount(amount)); }
+    void withdraw(uint32_t account, int64_t amount) { append(account, -checkAmount(amount)); }
+    void add(BankAccountCommand::Action action, uint32_t account, int64_t amount) {
+      action == BankAccountCommand::Action::deposit ? deposit(account, amount)
+                                                    : withdraw(account, amount);
+    }
+    [[nodiscard]] size_t size() const { return accounts.size(); }
+
+  private:
+    static int64_t checkAmount(int64_t amount) {
+      if (amount < 0)
+        throw std::invalid_argument("Ledger amounts must not be negative");
+      return amount;
+    }
+
+    void append(uint32_t account, int64_t delta) {
+      accounts.push_back(account);
+      deltas.push_back(delta);
+    }
+  };
+
+  Ledger(size_t account_count, size_t shards)
+    : account_count_(account_count), shard_count_(shards ? shards : 1),
+      // Shard boundaries fall on cache lines (8 balances per line).
+      per_shard_(((account_count + shard_count_ - 1) / shard_count_ + 7) / 8 * 8),
+      balances_(static_cast<int64_t *>(
+          ::operator new(per_shard_ * shard_count_ * sizeof(int64_t), std::align_val_t{64}))),
+      stats_(shard_count_), pool_(shard_count_) {
+    std::fill_n(balances_.get(), per_shard_ * shard_count_, 0);
+  }
+
+  [[nodiscard]] int64_t balance(uint32_t account) const {
+    if (account >= account_count_)
+      throw std::out_of_range("Ledger has no such account");
+    return balances_[account];
+  }
+  [[nodiscard]] size_t size() const { return account_count_; }
+
+  /**
+   * Applies every operation in `batch`; operations on the same account take
+   * effect in batch order. Writes one Status per operation and returns the
+   * number rejected.
+   */
+  size_t apply(const Batch &batch, std::vector<Status> &status) {
+    const size_t n = batch.size();
+    status.resize(n);
+    if (shard_count_ == 1)
+      return applyKernel(batch, n, [](size_t k) { return k; }, status.data());
+    if (n > UINT32_MAX)
+      throw std::length_error("batch too large for Ledger::apply");
+
+    // Group operation indices by shard with a parallel counting partition:
+    // each thread counts, then scatters, its own chunk of the batch.
+    const size_t chunk = (n + shard_count_ - 1) / shard_count_;
+    std::vector<size_t> offsets(shard_count_ * shard_count_, 0);
+    forEachShard([&](size_t c) {
+      std::vector<size_t> local(shard_count_, 0);
+      for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+        ++local[shardOf(batch.accounts[i])];
+      std::copy(local.begin(), local.end(), offsets.begin() + c * shard_count_);
+    });
+
+    std::vector<size_t> shard_begin(shard_count_ + 1, 0);
+    for (size_t sh = 0, pos = 0; sh < shard_count_; ++sh) {
+      shard_begin[sh] = pos;
+      for (size_t c = 0; c < shard_count_; ++c)
+        pos += std::exchange(offsets[c * shard_count_ + sh], pos);
+    }
+    shard_begin[shard_count_] = n;
+
+    std::unique_ptr<uint32_t[]> order(new uint32_t[n]);
+    forEachShard([&](size_t c) {
+      std::vector<size_t> next(offsets.begin() + c * shard_count_,
+                               offsets.begin() + (c + 1) * shard_count_);
+      for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+        order[next[shardOf(batch.accounts[i])]++] = static_cast<uint32_t>(i);
+    });
+
+    forEachShard([&](size_t sh) {
+      const uint32_t *ops = order.get() + shard_begin[sh];
+      stats_[sh].rejected = applyKernel(batch, shard_begin[sh + 1] - shard_begin[sh],
+                                        [ops](size_t k) { return ops[k]; }, status.data());
+    });
+
+    size_t rejected = 0;
+    for (const auto &st : stats_)
+      rejected += st.rejected;
+    return rejected;
+  }
+
+  /**
+   * Adds `deltas[i]` to account i for every account at once (interest,
+   * fees, ...). Straight-line and branch-free over contiguous arrays, so the
+   * compiler vectorizes it. Returns the number rejected.
+   */
+  size_t applyDense(const std::vector<int64_t> &deltas, std::vector<Status> &status) {
+    if (deltas.size() != account_count_)
+      throw std::invalid_argument("applyDense needs one delta per account");
+    status.resize(account_count_);
+
+    forEachShard([&](size_t sh) {
+      size_t begin = sh * per_shard_;
+      size_t end = std::min(account_count_, begin + per_shard_);
+      size_t rejected = 0;
+      for (size_t i = begin; i < end; ++i) {
+        auto s = check(balances_[i], deltas[i]);
+        balances_[i] = s.value;
+        status[i] = s.status;
+        rejected += s.status != Status::ok;
+      }
+      stats_[sh].rejected = rejected;
+    });
+
+    size_t rejected = 0;
+    for (const auto &st : stats_)
+      rejected += st.rejected;
+    return rejected;
+  }
+
+private:
+  struct Checked {
+    int64_t value;
+    Status status;
+  };
+
+  // The new balance, or the old one if the operation must be rejected.
+  static Checked check(int64_t balance, int64_t delta) {
+    auto sum = static_cast<int64_t>(static_cast<uint64_t>(balance) + static_cast<uint64_t>(delta));
+    bool overflow = ((balance ^ sum) & (delta ^ sum)) < 0;
+    bool insufficient = !overflow && delta < 0 && sum < 0;
+    auto status = static_cast<Status>(overflow ? 2 : insufficient ? 1 : 0);
+    return {status == Status::ok ? sum : balance, status};
+  }
+
+  // Applies operations index(0) .. index(count - 1) of the batch, in order.
+  // Branch-free: an unknown account is redirected to a scratch balance with
+  // a zero delta, and every outcome is picked by conditional moves, so
+  // rejections cost no mispredictions.
+  template <typename Index>
+  size_t applyKernel(const Batch &batch, size_t count, Index &&index, Status *status) {
+    int64_t scratch = 0;
+    size_t rejected = 0;
+    for (size_t k = 0; k < count; ++k) {
+      size_t i = index(k);
+      uint32_t account = batch.accounts[i];
+      bool known = account < account_count_;
+      int64_t *balance = known ? &balances_[account] : &scratch;
+      auto s = check(*balance, known ? batch.deltas[i] : 0);
+      *balance = s.value;
+      status[i] = known ? s.status : Status::unknown_account;
+      rejected += status[i] != Status::ok;
+    }
+    return rejected;
+  }
+
+  // Unknown accounts go to the last shard, whose kernel rejects them.
+  [[nodiscard]] size_t shardOf(uint32_t account) const {
+    return std::min<size_t>(account / per_shard_, shard_count_ - 1);
+  }
+
+  template <typename Fn>
+  void forEachShard(const Fn &fn) {
+    pool_.run(fn);
+  }
+
+  struct AlignedDelete {
+    void operator()(int64_t *p) const { ::operator delete(p, std::align_val_t{64}); }
+  };
+
+  // Per-shard counters, one cache line each so shards never share one.
+  struct alignas(64) ShardStats {
+    size_t rejected = 0;
+  };
+
+  size_t account_count_;
+  size_t shard_count_;
+  size_t per_shard_;
+  std::unique_ptr<int64_t[], AlignedDelete> balances_;
+  std::vector<ShardStats> stats_;
+  LanePool pool_;
+};
+
+} // end of namespace demo2
+
+TEST(command, ledger_test) {
+  using Status = demo2::Ledger::Status;
+  demo2::Ledger ledger(100, 4);
+
+  demo2::Ledger::Batch batch;
+  batch.deposit(1, 500);
+  batch.withdraw(1, 200);
+  batch.withdraw(1, 400);               // only 300 left
+  batch.deposit(99, INT64_MAX);
+  batch.deposit(99, 1);                 // would overflow
+  batch.add(demo2::BankAccountCommand::Action::deposit, 42, 7);
+  batch.deposit(100, 5);                // no such account
+  batch.deposit(UINT32_MAX, 5);
+
+  std::vector<Status> status;
+  EXPECT_EQ(ledger.apply(batch, status), 4u);
+  EXPECT_EQ(status, (std::vector<Status>{Status::ok, Status::ok, Status::insufficient_funds,
+                                         Status::ok, Status::overflow, Status::ok,
+                                         Status::unknown_account, Status::unknown_account}));
+  EXPECT_EQ(ledger.balance(1), 300);
+  EXPECT_EQ(ledger.balance(42), 7);
+  EXPECT_EQ(ledger.balance(99), INT64_MAX);
+  EXPECT_THROW((void)ledger.balance(100), std::out_of_range);
+
+  // The single-shard kernel rejects unknown accounts the same way.
+  demo2::Ledger small(10, 1);
+  EXPECT_EQ(small.apply(batch, status), 6u); // 1 overdraft, 5 unknown accounts
+  EXPECT_EQ(status[6], Status::unknown_account);
+
+  EXPECT_THROW(batch.withdraw(1, INT64_MIN), std::invalid_argument);
+  EXPECT_THROW(batch.deposit(1, -1), std::invalid_argument);
+
+  std::vector<int64_t> fees(100, -10);
+  EXPECT_EQ(ledger.applyDense(fees, status), 98u); // only 1 and 99 can pay
+  EXPECT_EQ(ledger.balance(1), 290);
+  EXPECT_EQ(ledger.balance(0), 0);
+}
+
+TEST(command, ledger_benchmark) {
+  constexpr size_t account_count = 1 << 20;
+  constexpr size_t op_count = 1 << 23;
+  const size_t shards = std::max(1u, std::thread::hardware_concurrency());
+
+  demo2::Ledger ledger(account_count, shards);
+  std::vector<demo2::Ledger::Status> status;
+
+  std::vector<int64_t> opening(account_count, 1'000'000);
+  ledger.applyDense(opening, status);
+
+  // Skewed: a quarter of all operations hit 16 hot accounts.
+  std::mt19937 rng(5);
+  demo2::Ledger::Batch batch;
+  batch.accounts.reserve(op_count);
+  batch.deltas.reserve(op_count);
+  for (size_t i = 0; i < op_count; ++i) {
+    auto account = static_cast<uint32_t>((rng() & 3) ? rng() % account_count : rng() % 16);
+    (i & 1) ? batch.deposit(account, rng() % 1000) : batch.withdraw(account, rng() % 1000);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t rejected = ledger.apply(batch, status);
+  auto sparse = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  constexpr int dense_rounds = 16;
+  std::vector<int64_t> interest(account_count, 3);
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < dense_rounds; ++r)
+    ledger.applyDense(interest, status);
+  auto dense = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  EXPECT_LT(rejected, op_count);
+  std::cout << "ledger, " << account_count << " accounts, " << shards << " shard(s):\n"
+            << "  sparse batch: " << op_count / sparse.count() / 1e6 << " M ops/s ("
+            << rejected << " rejected)\n"
+            << "  dense kernel: " << dense_rounds * account_count / dense.count() / 1e6
+            << " M ops/s\n";
+}
+
+namespace demo2 {
+/**
+ * Coalescing pass for command batches. All commands on the same account are
+ * folded into one net deposit or withdrawal (none at all when they cancel
+ * out), in order of each account's first appearance. Executing the result
+ * leaves every balance exactly where the original batch would, and undoing it
+ * restores exactly what undoing the original would; only the intermediate
+ * balances are skipped. Do not coalesce batches whose individual commands
+ * may be refused (try_execute), since refusal depends on those intermediate
+ * balances.
+ */
+struct CoalesceStats {
+  size_t input = 0;
+  size_t output = 0;
+  size_t accounts = 0;   // distinct accounts touched
+  size_t cancelled = 0;  // accounts whose commands summed to zero
+
+  [[nodiscard]] size_t eliminated() const { return input - output; }
+};
+
+// Fills in `stats` for this batch alone; whatever it held before is reset.
+CompositeBankAccountCommand coalesce(const CompositeBankAccountCommand &batch,
+                                     CoalesceStats &stats) {
+  using Action = BankAccountCommand::Action;
+  stats = {};
+
+  std::unordered_map<BankAccount *, size_t> slot;
+  std::vector<std::pair<BankAccount *, int64_t>> net;
+  slot.reserve(batch.size());
+  for (const auto &cmd : batch) {
+    auto [it, inserted] = slot.try_emplace(&cmd.m_ac, net.size());
+    if (inserted)
+      net.emplace_back(&cmd.m_ac, 0);
+    net[it->second].second += cmd.m_action == Action::deposit ? int64_t{cmd.m_amount}
+                                                              : -int64_t{cmd.m_amount};
+  }
+
+  CompositeBankAccountCommand result;
+  for (auto [account, delta] : net) {
+    if (delta == 0)
+      ++stats.cancelled;
+    auto action = delta > 0 ? Action::deposit : Action::withdraw;
+    uint64_t remaining = delta > 0 ? uint64_t(delta) : uint64_t(0) - uint64_t(delta);
+    // A net amount beyond int32 range becomes several commands.
+    while (remaining > 0) {
+      auto amount = static_cast<int32_t>(std::min<uint64_t>(remaining, INT32_MAX));
+      result.emplace_back(*account, action, amount);
+      remaining -= static_cast<uint64_t>(amount);
+    }
+  }
+
+  stats.input = batch.size();
+  stats.output = result.size();
+  stats.accounts = net.size();
+  return result;
+}
+
+} // end of namespace demo2
+
+TEST(command, coalesce_test) {
+  using Action = demo2::BankAccountCommand::Action;
+  demo2::BankAccount a{1000}, b{1000}, c{1000};
+
+  demo2::CompositeBankAccountCommand batch{
+      {a, Action::deposit, 100}, {b, Action::withdraw, 50}, {a, Action::withdraw, 30},
+      {c, Action::deposit, 10},  {b, Action::withdraw, 25}, {c, Action::withdraw, 10},
+      {a, Action::deposit, 5}};
+
+  demo2::CoalesceStats stats;
+  auto merged = demo2::coalesce(batch, stats);
+
+  EXPECT_EQ(stats.input, 7u);
+  EXPECT_EQ(stats.output, 2u);
+  EXPECT_EQ(stats.accounts, 3u);
+  EXPECT_EQ(stats.cancelled, 1u); // c nets to zero
+  EXPECT_EQ(stats.eliminated(), 5u);
+  ASSERT_EQ(merged.size(), 2u);
+  EXPECT_EQ(&merged[0].m_ac, &a);
+  EXPECT_EQ(merged[0].m_amount, 75);
+  EXPECT_EQ(merged[1].m_action, Action::withdraw);
+  EXPECT_EQ(merged[1].m_amount, 75);
+
+  merged.execute();
+  EXPECT_EQ(a.balance_, 1075);
+  EXPECT_EQ(b.balance_, 925);
+  EXPECT_EQ(c.balance_, 1000);
+  merged.undo();
+  EXPECT_EQ(a.balance_, 1000);
+  EXPECT_EQ(b.balance_, 1000);
+  EXPECT_EQ(c.balance_, 1000);
+
+  // A net amount outside int32 range is split rather than truncated.
+  demo2::CompositeBankAccountCommand big{
+      {a, Action::deposit, INT32_MAX}, {a, Action::withdraw, 75}, {a, Action::deposit, INT32_MAX}};
+  auto split = demo2::coalesce(big, stats);
+  ASSERT_EQ(split.size(), 2u);
+  EXPECT_EQ(split[0].m_amount, INT32_MAX);
+  EXPECT_EQ(split[1].m_amount, INT32_MAX - 75);
+
+  // The stats describe the latest batch only, not the running total.
+  EXPECT_EQ(stats.input, 3u);
+  EXPECT_EQ(stats.output, 2u);
+  EXPECT_EQ(stats.accounts, 1u);
+  EXPECT_EQ(stats.cancelled, 0u);
+}
+
+TEST(command, coalesce_benchmark) {
+  using Action = demo2::BankAccountCommand::Action;
+  constexpr size_t account_count = 10'000;
+  constexpr size_t command_count = 1'000'000;
+
+  // Skewed towards low account ids, as real traffic is.
+  std::vector<demo2::BankAccount> accounts(account_count, demo2::BankAccount{0});
+  std::mt19937 rng(13);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  demo2::CompositeBankAccountCommand batch;
+  batch.reserve(command_count);
+  for (size_t i = 0; i < command_count; ++i) {
+    auto id = static_cast<size_t>(account_count * std::pow(u(rng), 4.0));
+    batch.emplace_back(accounts[std::min(id, account_count - 1)],
+                       (rng() & 1) ? Action::deposit : Action::withdraw,
+                       static_cast<int32_t>(rng() % 100));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  batch.execute();
+  auto plain = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  std::vector<int32_t> expected;
+  for (auto &a : accounts)
+    expected.push_back(std::exchange(a.balance_, 0));
+
+  start = std::chrono::steady_clock::now();
+  demo2::CoalesceStats stats;
+  auto merged = demo2::coalesce(batch, stats);
+  merged.execute();
+  auto coalesced = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  for (size_t i = 0; i < account_count; ++i)
+    EXPECT_EQ(accounts[i].balance_, expected[i]);
+
+  // Where execution is expensive, e.g. every command is journaled, the
+  // eliminated commands are what counts.
+  constexpr size_t journaled_count = 2'000;
+  auto dir = std::filesystem::temp_directory_path() / "command_coalesce_bench";
+  std::filesystem::remove_all(dir);
+  demo2::JournaledBank bank(dir, 1000);
+  demo2::CompositeBankAccountCommand journaled;
+  for (size_t i = 0; i < journaled_count; ++i) {
+    auto id = static_cast<size_t>(bank.size() * std::pow(u(rng), 4.0));
+    journaled.emplace_back(bank.account(std::min(id, bank.size() - 1)), Action::deposit,
+                           static_cast<int32_t>(rng() % 100));
+  }
+
+  start = std::chrono::steady_clock::now();
+  for (auto &cmd : journaled)
+    bank.commit(cmd);
+  auto journal_plain = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  demo2::CoalesceStats journal_stats;
+  auto journal_merged = demo2::coalesce(journaled, journal_stats);
+  for (auto &cmd : journal_merged)
+    bank.commit(cmd);
+  auto journal_coalesced = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  std::filesystem::remove_all(dir);
+
+  std::cout << command_count << " commands over " << account_count << " skewed accounts:\n"
+            << "  coalesced to " << stats.output << " (" << stats.eliminated()
+            << " eliminated, " << 100.0 * stats.eliminated() / stats.input << "%)\n"
+            << "  in memory: execute as is " << plain.count() * 1e3
+            << " ms, coalesce + execute " << coalesced.count() * 1e3 << " ms\n"
+            << journaled_count << " journaled commands: " << journal_stats.input << " -> "
+            << journal_stats.output << " records, commit as is " << journal_plain.count() * 1e3
+            << " ms, coalesce + commit " << journal_coalesced.count() * 1e3 << " ms\n";
+}
+
+namespace async_command {
+/**
+ * Asynchronous counterpart of Command/Invoker. An AsyncCommand's Execute is a
+ * C++20 coroutine that can `co_await` timers and file descriptors on a
+ * single-threaded EventLoop (epoll plus one timerfd). A suspended command
+ * costs one coroutine frame instead of a blocked thread, so thousands can be
+ * in flight on one thread.
+ */
+
+/**
+ * A lazily started coroutine returning nothing. Awaiting a Task starts it and
+ * resumes the awaiter when it finishes (rethrowing its exception, if any).
+ */
+class Task {
+public:
+  struct promise_type;
+  using handle = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    Task get_return_object() { return Task{handle::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(handle h) noexcept {
+        return h.promise().continuation;
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void return_void() {}
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  Task(Task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (h_)
+        h_.destroy();
+      h_ = std::exchange(other.h_, {});
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (h_)
+      h_.destroy();
+  }
+
+  bool await_ready() const noexcept { return !h_ || h_.done(); }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    h_.promise().continuation = awaiting;
+    return h_;
+  }
+  void await_resume() {
+    if (h_ && h_.promise().error)
+      std::rethrow_exception(h_.promise().error);
+  }
+
+private:
+  explicit Task(handle h) : h_(h) {}
+  handle h_;
+};
+
+// Fire-and-forget coroutine: starts at once and frees itself when done.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+class EventLoop {
+  using clock = std::chrono::steady_clock;
+
+public:
+  EventLoop() {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+      throw std::system_error(errno, std::generic_category(), "epoll_create1");
+
+    // The destructor does not run for a constructor that throws, so every
+    // failure below closes what is already open.
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      int err = errno;
+      ::close(epoll_fd_);
+      throw std::system_error(err, std::generic_category(), "timerfd_create");
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // the timerfd
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev) < 0) {
+      int err = errno;
+      ::close(timer_fd_);
+      ::close(epoll_fd_);
+      throw std::system_error(err, std::generic_category(), "epoll_ctl");
+    }
+  }
+
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  ~EventLoop() {
+    ::close(timer_fd_);
+    ::close(epoll_fd_);
+  }
+
+  // co_await loop.sleep_for(d): resumes on the loop once `d` has passed.
+  auto sleep_for(std::chrono::nanoseconds d) {
+    struct Awaiter {
+      EventLoop &loop;
+      clock::time_point deadline;
+
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        loop.timers_.push({deadline, loop.timer_seq_++, h});
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{*this, clock::now() + d};
+  }
+
+  // co_await loop.readable(fd): resumes once `fd` has data to read.
+  auto readable(int fd) {
+    struct Awaiter {
+      EventLoop &loop;
+      int fd;
+      std::coroutine_handle<> h;
+
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        h = handle;
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = this;
+        if (::epoll_ctl(loop.epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+          throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        ++loop.io_waiters_;
+      }
+      void await_resume() const noexcept {}
+    };
+    return Awaiter{*this, fd, {}};
+  }
+
+  // Starts `task` now; run() keeps going until it and all others finish.
+  void spawn(Task task) { runDetached(std::move(task)); }
+
+  // Runs until every spawned task has finished. Rethrows the first exception
+  // a spawned task let escape.
+  void run() {
+    epoll_event events[64];
+    while (active_ > 0) {
+      auto now = clock::now();
+      while (!timers_.empty() && timers_.top().deadline <= now) {
+        auto h = timers_.top().h;
+        timers_.pop();
+        h.resume();
+      }
+      if (active_ == 0)
+        break;
+      if (timers_.empty() && io_waiters_ == 0)
+        throw std::logic_error("EventLoop: tasks are waiting on nothing");
+
+      armTimer();
+      int n = ::epoll_wait(epoll_fd_, events, 64, -1);
+      if (n < 0 && errno != EINTR)
+        throw std::system_error(errno, std::generic_category(), "epoll_wait");
+
+      for (int i = 0; i < n; ++i) {
+        if (events[i].data.ptr == nullptr) {
+          uint64_t expirations;
+          [[maybe_unused]] auto r = ::read(timer_fd_, &expirations, sizeof(expirations));
+          continue;
+        }
+        using IoAwaiter = decltype(readable(0));
+        auto *waiter = static_cast<IoAwaiter *>(events[i].data.ptr);
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, waiter->fd, nullptr);
+        --io_waiters_;
+        waiter->h.resume();
+      }
+    }
+
+    if (error_)
+      std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+  void run(Task task) {
+    spawn(std::move(task));
+    run();
+  }
+
+private:
+  struct Timer {
+    clock::time_point deadline;
+    uint64_t seq; // keeps equal deadlines in FIFO order
+    std::coroutine_handle<> h;
+
+    bool operator>(const Timer &other) const {
+      return std::tie(deadline, seq) > std::tie(other.deadline, other.seq);
+    }
+  };
+
+  Detached runDetached(Task task) {
+    ++active_;
+    try {
+      co_await task;
+    } catch (...) {
+      if (!error_)
+        error_ = std::current_exception();
+    }
+    --active_;
+  }
+
+  // Points the timerfd at the earliest pending deadline; every timer due by
+  // then fires in one batch when it goes off.
+  void armTimer() {
+    itimerspec spec{};
+    if (!timers_.empty()) {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    timers_.top().deadline.time_since_epoch()).count();
+      spec.it_value.tv_sec = ns / 1'000'000'000;
+      spec.it_value.tv_nsec = ns % 1'000'000'000;
+      if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1; // all zero would disarm
+    }
+    ::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+  }
+
+  int epoll_fd_ = -1;
+  int timer_fd_ = -1;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers_;
+  uint64_t timer_seq_ = 0;
+  size_t io_waiters_ = 0;
+  size_t active_ = 0;
+  std::exception_ptr error_;
+};
+
+/**
+ * Structured concurrency: runs all `tasks` concurrently and completes when
+ * every one of them has, rethrowing the first exception afterwards. No task
+ * outlives the call.
+ */
+Task when_all(std::vector<Task> tasks) {
+  struct State {
+    size_t remaining;
+    std::coroutine_handle<> parent;
+    std::exception_ptr error;
+  };
+
+  struct Child {
+    static Detached run(Task &task, State &state) {
+      try {
+        co_await task;
+      } catch (...) {
+        if (!state.error)
+          state.error = std::current_exception();
+      }
+      if (--state.remaining == 0)
+        state.parent.resume();
+    }
+  };
+
+  struct Awaiter {
+    std::vector<Task> &tasks;
+    State &state;
+
+    bool await_ready() const noexcept { return tasks.empty(); }
+    bool await_suspend(std::coroutine_handle<> parent) {
+      state.parent = parent;
+      // One extra count held while starting, so that children finishing
+      // synchronously cannot resume us before we are done suspending.
+      state.remaining = tasks.size() + 1;
+      for (auto &t : tasks)
+        Child::run(t, state);
+      return --state.remaining != 0;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  State state{};
+  co_await Awaiter{tasks, state};
+  if (state.error)
+    std::rethrow_exception(state.error);
+}
+
+class AsyncCommand {
+public:
+  virtual ~AsyncCommand() = default;
+  virtual Task Execute(EventLoop &loop) const = 0;
+};
+
+// Any synchronous Command can take part; it simply never suspends.
+class SyncCommand : public AsyncCommand {
+public:
+  explicit SyncCommand(std::unique_ptr<Command> command) : command_(std::move(command)) {}
+
+  Task Execute(EventLoop &) const override {
+    command_->Execute();
+    co_return;
+  }
+
+private:
+  std::unique_ptr<Command> command_;
+};
+
+class DelayedCommand : public AsyncCommand {
+public:
+  DelayedCommand(std::string pay_load, std::chrono::milliseconds delay)
+    : pay_load_(std::move(pay_load)), delay_(delay) {}
+
+  Task Execute(EventLoop &loop) const override {
+    co_await loop.sleep_for(delay_);
+    std::cout << "DelayedCommand: " << pay_load_ << " after " << delay_.count() << "ms\n";
+  }
+
+private:
+  std::string pay_load_;
+  std::chrono::milliseconds delay_;
+};
+
+// Waits for one line on a file descriptor, then prints it.
+class ReadLineCommand : public AsyncCommand {
+public:
+  explicit ReadLineCommand(int fd) : fd_(fd) {}
+
+  Task Execute(EventLoop &loop) const override {
+    co_await loop.readable(fd_);
+    char buf[256];
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    std::cout << "ReadLineCommand: got " << std::string_view(buf, n > 0 ? n : 0);
+  }
+
+private:
+  int fd_;
+};
+
+/**
+ * Like Invoker, but takes any number of on-start and on-finish commands and
+ * runs each group concurrently on the loop.
+ */
+class AsyncInvoker {
+public:
+  void AddOnStart(std::unique_ptr<AsyncCommand> command) { on_start_.push_back(std::move(command)); }
+  void AddOnFinish(std::unique_ptr<AsyncCommand> command) { on_finish_.push_back(std::move(command)); }
+
+  Task DoSomethingImportant(EventLoop &loop) {
+    std::cout << "Invoker: Does anybody want something done before I begin?\n";
+    co_await runAll(on_start_, loop);
+
+    std::cout << "Invoker: ...doing something really important...\n";
+    std::cout << "Invoker: Does anybody want something done after I finish?\n";
+    co_await runAll(on_finish_, loop);
+  }
+
+private:
+  static Task runAll(const std::vector<std::unique_ptr<AsyncCommand>> &commands, EventLoop &loop) {
+    std::vector<Task> tasks;
+    tasks.reserve(commands.size());
+    for (const auto &c : commands)
+      tasks.push_back(c->Execute(loop));
+    co_await when_all(std::move(tasks));
+  }
+
+  std::vector<std::unique_ptr<AsyncCommand>> on_start_;
+  std::vector<std::unique_ptr<AsyncCommand>> on_finish_;
+};
+
+} // end of namespace async_command
+
+namespace {
+
+// Writes `line` into `fd` after `delay`, from the loop.
+async_command::Task writeLater(async_command::EventLoop &loop, int fd, std::string line,
+                               std::chrono::milliseconds delay) {
+  co_await loop.sleep_for(delay);
+  [[maybe_unused]] auto n = ::write(fd, line.data(), line.size());
+}
+
+async_command::Task sleepCommand(async_command::EventLoop &loop, std::chrono::milliseconds d,
+                                 size_t &done) {
+  co_await loop.sleep_for(d);
+  ++done;
+}
+
+} // namespace
+
+TEST(command, async_invoker_test) {
+  using namespace async_command;
+  using namespace std::chrono_literals;
+
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+
+  AsyncInvoker invoker;
+  invoker.AddOnStart(std::make_unique<DelayedCommand>("slow", 30ms));
+  invoker.AddOnStart(std::make_unique<DelayedCommand>("fast", 10ms));
+  invoker.AddOnStart(std::make_unique<ReadLineCommand>(fds[0]));
+  invoker.AddOnStart(std::make_unique<SyncCommand>(std::make_unique<SimpleCommand>("Say Hi!")));
+  invoker.AddOnFinish(std::make_unique<DelayedCommand>("done", 1ms));
+
+  EventLoop loop;
+  testing::internal::CaptureStdout();
+  loop.spawn(writeLater(loop, fds[1], "ping\n", 20ms));
+  loop.run(invoker.DoSomethingImportant(loop));
+
+  // The on-start commands overlap, so they finish in order of their delays.
+  EXPECT_EQ(testing::internal::GetCapturedStdout(),
+            "Invoker: Does anybody want something done before I begin?\n"
+            "SimpleCommand: See, I can do simple things like print (Say Hi!)\n"
+            "DelayedCommand: fast after 10ms\n"
+            "ReadLineCommand: got ping\n"
+            "DelayedCommand: slow after 30ms\n"
+            "Invoker: ...doing something really important...\n"
+            "Invoker: Does anybody want something done after I finish?\n"
+            "DelayedCommand: done after 1ms\n");
+
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST(command, async_event_loop_setup_failure) {
+  // Leave room for exactly one more descriptor: the epoll fd is created,
+  // the timerfd is not.
+  int lowest = ::dup(0);
+  ASSERT_GE(lowest, 0);
+  ::close(lowest);
+
+  rlimit saved{};
+  ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &saved), 0);
+  rlimit tight = saved;
+  tight.rlim_cur = static_cast<rlim_t>(lowest) + 1;
+  ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &tight), 0);
+  EXPECT_THROW(async_command::EventLoop{}, std::system_error);
+  ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &saved), 0);
+
+  // The epoll fd was closed again rather than leaked.
+  int next = ::dup(0);
+  EXPECT_EQ(next, lowest);
+  ::close(next);
+}
+
+TEST(command, async_invoker_benchmark) {
+  using namespace std::chrono_literals;
+  constexpr size_t in_flight = 2'000;
+  constexpr auto delay = 20ms;
+
+  auto cpu_seconds = [] {
+    rusage ru{};
+    ::getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+  };
+
+  size_t done = 0;
+  auto cpu = cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  {
+    async_command::EventLoop loop;
+    std::vector<async_command::Task> tasks;
+    for (size_t i = 0; i < in_flight; ++i)
+      tasks.push_back(sleepCommand(loop, delay, done));
+    loop.run(async_command::when_all(std::move(tasks)));
+  }
+  auto loop_wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  auto loop_cpu = cpu_seconds() - cpu;
+  EXPECT_EQ(done, in_flight);
+
+  std::atomic<size_t> thread_done{0};
+  cpu = cpu_seconds();
+  start = std::chrono::steady_clock::now();
+  {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < in_flight; ++i)
+      threads.emplace_back([&thread_done, delay] {
+        std::this_thread::sleep_for(delay);
+        ++thread_done;
+      });
+    for (auto &t : threads)
+      t.join();
+  }
+  auto thread_wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  auto thread_cpu = cpu_seconds() - cpu;
+  EXPECT_EQ(thread_done.load(), in_flight);
+
+  std::cout << in_flight << " commands waiting " << delay.count() << "ms each:\n"
+            << "  event loop: " << loop_wall.count() * 1e3 << " ms wall, "
+            << loop_cpu * 1e3 << " ms CPU, 1 thread\n"
+            << "  thread per command: " << thread_wall.count() * 1e3 << " ms wall, "
+            << thread_cpu * 1e3 << " ms CPU, " << in_flight << " threads\n";
+}
+
+namespace scheduler {
+/**
+ * CommandScheduler runs commands after a delay, or periodically, on its own
+ * thread.
+ *
+ * Pending commands live in a hierarchical timing wheel: four levels of 256
+ * slots, where level 0 holds the next 256 ticks and each further level covers
+ * 256 times the span of the one below it. A command is placed in the slot of
+ * the coarsest level it needs. When a level-0 lap completes, the next slot of
+ * level 1 is cascaded down, and so on up the levels. Slots are intrusive
+ * doubly linked lists over a node pool, so schedule and cancel are O(1)
+ * whatever the number of pending commands. Each tick fires its whole slot as
+ * one batch outside the lock.
+ */
+class CommandScheduler {
+public:
+  using Id = uint64_t;
+  using Callback = inplaceCommand<48>;
+
+  struct Options {
+    std::chrono::microseconds tick{1000};
+  };
+
+  CommandScheduler() : CommandScheduler(Options{}) {}
+
+  explicit CommandScheduler(Options options)
+    : tick_(options.tick), start_(std::chrono::steady_clock::now()) {
+    std::fill(std::begin(slots_), std::end(slots_), kNil);
+    worker_ = std::thread([this] { run(); });
+  }
+
+  CommandScheduler(const CommandScheduler &) = delete;
+  CommandScheduler &operator=(const CommandScheduler &) = delete;
+
+  // Commands still pending are dropped without running.
+  ~CommandScheduler() {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    worker_.join();
+  }
+
+  // Runs `command` once, no earlier than `delay` from now.
+  template <typename C, typename = std::enable_if_t<std::is_base_of_v<Command, C>>>
+  Id schedule(C &&command, std::chrono::nanoseconds delay) {
+    return add(wrap(std::move(command)), delay, 0);
+  }
+
+  // Runs `command` every `period`, starting one period from now, until it is
+  // cancelled. Firings keep to the original grid rather than drifting.
+  template <typename C, typename = std::enable_if_t<std::is_base_of_v<Command, C>>>
+  Id schedule_every(C &&command, std::chrono::nanoseconds period) {
+    return add(wrap(std::move(command)), period, std::max<uint64_t>(1, ticksCeil(period)));
+  }
+
+  // Returns true if the command was pending (or is a periodic command that is
+  // firing right now) and will not run again.
+  bool cancel(Id id) {
+    std::lock_guard lock(mutex_);
+    auto index = static_cast<uint32_t>(id);
+    if (index >= nodes_.size() || nodes_[index].generation != static_cast<uint32_t>(id >> 32))
+      return false;
+
+    Node &node = nodes_[index];
+    if (node.state == State::pending) {
+      unlink(index);
+      release(index);
+      return true;
+    }
+    if (node.state == State::firing && node.period != 0) {
+      // The worker releases the node after the firing, but it stops
+      // counting as pending now.
+      node.state = State::cancelled;
+      --pending_;
+      return true;
+    }
+    return false;
+  }
+
+  // Commands that are scheduled or firing and not cancelled.
+  [[nodiscard]] size_t pending() const {
+    std::lock_guard lock(mutex_);
+    return pending_;
+  }
+
+  // Bytes held by the node pool and the wheel.
+  [[nodiscard]] size_t memory_bytes() const {
+    std::lock_guard lock(mutex_);
+    return nodes_.capacity() * sizeof(Node) + sizeof(slots_);
+  }
+
+private:
+  static constexpr uint32_t kNil = UINT32_MAX;
+  static constexpr unsigned kLevels = 4;
+  static constexpr unsigned kBits = 8;
+  static constexpr uint64_t kSlots = 1u << kBits;
+  static constexpr uint64_t kMask = kSlots - 1;
+  static constexpr uint64_t kMaxDelta = (uint64_t{1} << (kLevels * kBits)) - 1;
+
+  enum class State : uint8_t { free, pending, firing, cancelled };
+
+  struct Node {
+    Callback callback;
+    uint64_t expire = 0; // tick
+    uint64_t period = 0; // ticks, 0 for one-shot
+    uint32_t prev = kNil;
+    uint32_t next = kNil;
+    uint32_t slot = kNil;
+    uint32_t generation = 0;
+    State state = State::free;
+  };
+
+  template <typename C>
+  static Callback wrap(C &&command) {
+    return [command = std::forward<C>(command)] { command.Execute(); };
+  }
+
+  [[nodiscard]] uint64_t ticksCeil(std::chrono::nanoseconds d) const {
+    auto tick = std::chrono::duration_cast<std::chrono::nanoseconds>(tick_).count();
+    return d.count() <= 0 ? 0 : (static_cast<uint64_t>(d.count()) + tick - 1) / tick;
+  }
+
+  [[nodiscard]] uint64_t nowTick() const {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    return static_cast<uint64_t>(elapsed / tick_);
+  }
+
+  Id add(Callback callback, std::chrono::nanoseconds delay, uint64_t period) {
+    std::unique_lock lock(mutex_);
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    bool was_idle = pending_ == 0;
+    if (was_idle)
+      current_ = std::max(current_, static_cast<uint64_t>(elapsed / tick_));
+
+    uint32_t index;
+    if (free_ != kNil) {
+      index = free_;
+      free_ = nodes_[index].next;
+    } else {
+      if (nodes_.size() == kNil)
+        throw std::length_error("CommandScheduler: too many pending commands");
+      index = static_cast<uint32_t>(nodes_.size());
+      nodes_.emplace_back();
+    }
+
+    Node &node = nodes_[index];
+    node.callback = std::move(callback);
+    // Tick k fires once k whole ticks have elapsed; rounding the deadline up
+    // means a command is never early and at most one tick late.
+    node.expire = ticksCeil(elapsed + delay);
+    node.period = period;
+    insert(index);
+    ++pending_;
+    Id id = (uint64_t{node.generation} << 32) | index;
+
+    lock.unlock();
+    if (was_idle)
+      wake_.notify_one();
+    return id;
+  }
+
+  // Files the node under its expiry. One beyond the wheel's span is parked
+  // kMaxDelta ticks out and re-filed from there, as often as it takes; its
+  // own expire is left alone, so it never fires early.
+  void insert(uint32_t index) {
+    Node &node = nodes_[index];
+    node.state = State::pending;
+    uint64_t expire = std::max(node.expire, current_);
+    uint64_t delta = std::min(expire - current_, kMaxDelta);
+    expire = current_ + delta;
+
+    unsigned level = 0;
+    while (level + 1 < kLevels && delta >= (uint64_t{1} << ((level + 1) * kBits)))
+      ++level;
+    auto slot = static_cast<uint32_t>(level * kSlots + ((expire >> (level * kBits)) & kMask));
+
+    node.slot = slot;
+    node.prev = kNil;
+    node.next = slots_[slot];
+    if (node.next != kNil)
+      nodes_[node.next].prev = index;
+    slots_[slot] = index;
+  }
+
+  void unlink(uint32_t index) {
+    Node &node = nodes_[index];
+    if (node.prev != kNil)
+      nodes_[node.prev].next = node.next;
+    else
+      slots_[node.slot] = node.next;
+    if (node.next != kNil)
+      nodes_[node.next].prev = node.prev;
+  }
+
+  void release(uint32_t index) {
+    Node &node = nodes_[index];
+    if (node.state != State::cancelled) // cancel() already uncounted it
+      --pending_;
+    node.callback = Callback{};
+    node.state = State::free;
+    ++node.generation;
+    node.next = free_;
+    free_ = index;
+  }
+
+  // Moves the commands due at tick `current_` into `batch_` and advances.
+  void advance() {
+    uint64_t index = current_ & kMask;
+    for (unsigned level = 1; index == 0 && level < kLevels; ++level) {
+      index = (current_ >> (level * kBits)) & kMask;
+      uint32_t n = std::exchange(slots_[level * kSlots + index], kNil);
+      while (n != kNil) {
+        uint32_t next = nodes_[n].next;
+        insert(n);
+        n = next;
+      }
+    }
+
+    uint32_t n = std::exchange(slots_[current_ & kMask], kNil);
+    while (n != kNil) {
+      Node &node = nodes_[n];
+      uint32_t next = node.next;
+      if (node.expire > current_) {
+        insert(n); // parked, not due yet
+      } else {
+        node.state = State::firing;
+        batch_.emplace_back(n, std::move(node.callback));
+      }
+      n = next;
+    }
+    ++current_;
+  }
+
+  void run() {
+    std::unique_lock lock(mutex_);
+    while (!stop_) {
+      if (pending_ == 0) {
+        wake_.wait(lock, [this] { return stop_ || pending_ > 0; });
+        continue;
+      }
+
+      uint64_t now = nowTick();
+      while (current_ <= now && batch_.empty())
+        advance();
+
+      if (batch_.empty()) {
+        wake_.wait_until(lock, start_ + tick_ * current_);
+        continue;
+      }
+
+      lock.unlock();
+      for (auto &[index, callback] : batch_)
+        callback();
+      lock.lock();
+
+      for (auto &[index, callback] : batch_) {
+        Node &node = nodes_[index];
+        if (node.state == State::firing && node.period != 0) {
+          node.callback = std::move(callback);
+          node.expire += node.period;
+          insert(index);
+        } else {
+          release(index);
+        }
+      }
+      batch_.clear();
+    }
+  }
+
+  const std::chrono::microseconds tick_;
+  const std::chrono::steady_clock::time_point start_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+
+  std::vector<Node> nodes_;
+  uint32_t free_ = kNil;
+  uint32_t slots_[kLevels * kSlots];
+  uint64_t current_ = 0; // next tick to process
+  size_t pending_ = 0;   // scheduled, not yet released and not cancelled
+  std::vector<std::pair<uint32_t, Callback>> batch_;
+
+  std::thread worker_;
+};
+
+} // end of namespace scheduler
+
+namespace {
+
+// Records when it ran.
+class StampCommand : public Command {
+public:
+  explicit StampCommand(std::chrono::steady_clock::time_point *slot) : slot_(slot) {}
+  void Execute() const override { *slot_ = std::chrono::steady_clock::now(); }
+
+private:
+  std::chrono::steady_clock::time_point *slot_;
+};
+
+class CountCommand : public Command {
+public:
+  explicit CountCommand(std::atomic<int> *count) : count_(count) {}
+  void Execute() const override { count_->fetch_add(1, std::memory_order_relaxed); }
+
+private:
+  std::atomic<int> *count_;
+};
+
+} // namespace
+
+TEST(command, scheduler_test) {
+  using namespace std::chrono_literals;
+  scheduler::CommandScheduler scheduler;
+
+  testing::internal::CaptureStdout();
+  scheduler.schedule(SimpleCommand("third"), 30ms);
+  scheduler.schedule(SimpleCommand("first"), 10ms);
+  auto id = scheduler.schedule(SimpleCommand("never"), 15ms);
+  scheduler.schedule(SimpleCommand("second"), 20ms);
+  EXPECT_TRUE(scheduler.cancel(id));
+  EXPECT_FALSE(scheduler.cancel(id));
+
+  std::atomic<int> ticks{0};
+  auto every = scheduler.schedule_every(CountCommand(&ticks), 2ms);
+
+  while (scheduler.pending() > 1)
+    std::this_thread::sleep_for(1ms);
+  EXPECT_TRUE(scheduler.cancel(every));
+  EXPECT_EQ(scheduler.pending(), 0);
+  EXPECT_GE(ticks.load(), 3);
+
+  std::stringstream oss;
+  oss << "SimpleCommand: See, I can do simple things like print (first)\n"
+      << "SimpleCommand: See, I can do simple things like print (second)\n"
+      << "SimpleCommand: See, I can do simple things like print (third)\n";
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), oss.str());
+
+  // Far-off commands cascade down through the levels but stay cancellable.
+  auto far = scheduler.schedule(SimpleCommand("far"), 24h);
+  EXPECT_EQ(scheduler.pending(), 1);
+  EXPECT_TRUE(scheduler.cancel(far));
+}
+
+TEST(command, scheduler_benchmark) {
+  using namespace std::chrono_literals;
+  using clock = std::chrono::steady_clock;
+
+  // Fire-time jitter: how late each command runs relative to its deadline.
+  constexpr size_t timed = 5'000;
+  std::vector<clock::time_point> deadlines(timed), fired(timed);
+  {
+    scheduler::CommandScheduler scheduler;
+    std::mt19937 rng(40);
+    std::uniform_int_distribution<int> delay_us(0, 100'000);
+    for (size_t i = 0; i < timed; ++i) {
+      auto delay = std::chrono::microseconds(delay_us(rng));
+      deadlines[i] = clock::now() + delay;
+      scheduler.schedule(StampCommand(&fired[i]), delay);
+    }
+    while (scheduler.pending() > 0)
+      std::this_thread::sleep_for(1ms);
+  }
+  std::vector<int64_t> late_us(timed);
+  for (size_t i = 0; i < timed; ++i)
+    late_us[i] = std::chrono::duration_cast<std::chrono::microseconds>(fired[i] - deadlines[i]).count();
+  std::sort(late_us.begin(), late_us.end());
+  EXPECT_GE(late_us.front(), 0);
+
+  // Many pending commands: insert and cancel cost, and memory held.
+  constexpr size_t many = 1'000'000;
+  std::vector<scheduler::CommandScheduler::Id> ids(many);
+  std::atomic<int> count{0};
+  scheduler::CommandScheduler scheduler;
+  std::mt19937 rng(41);
+  std::uniform_int_distribution<int> delay_s(60, 24 * 3600);
+
+  auto start = clock::now();
+  for (size_t i = 0; i < many; ++i)
+    ids[i] = scheduler.schedule(CountCommand(&count), std::chrono::seconds(delay_s(rng)));
+  auto insert_time = std::chrono::duration<double>(clock::now() - start);
+  EXPECT_EQ(scheduler.pending(), many);
+  size_t bytes = scheduler.memory_bytes();
+
+  std::shuffle(ids.begin(), ids.end(), rng);
+  start = clock::now();
+  size_t cancelled = 0;
+  for (auto id : ids)
+    cancelled += scheduler.cancel(id);
+  auto cancel_time = std::chrono::duration<double>(clock::now() - start);
+  EXPECT_EQ(cancelled, many);
+  EXPECT_EQ(count.load(), 0);
+
+  std::cout << "command scheduler, 1ms tick:\n"
+            << "  jitter over " << timed << " commands: p50 " << late_us[timed / 2] << " us, p99 "
+            << late_us[timed * 99 / 100] << " us, max " << late_us.back() << " us\n"
+            << "  " << many << " pending: " << insert_time.count() * 1e9 / many << " ns/schedule, "
+            << cancel_time.count() * 1e9 / many << " ns/cancel, "
+            << static_cast<double>(bytes) / many << " bytes/command\n";
+}
@@ -0,0 +1,18 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace alloc_counter {
+std::atomic<size_t> allocations{0};
+} // namespace alloc_counter
+
+void *operator new(size_t size) {
+  alloc_counter::allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
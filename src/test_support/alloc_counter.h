@@ -0,0 +1,13 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Counts every allocation made through the global operator new, so tests can
+ * assert that a code path does not allocate. The replacement operator new
+ * lives in alloc_counter.cc and is linked into the whole test binary.
+ */
+namespace alloc_counter {
+extern std::atomic<size_t> allocations;
+} // namespace alloc_counter
@@ -1,7 +1,32 @@
 #include <gtest/gtest.h>
 #include <iostream>
 #include <array>
+#include <initializer_list>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace visitor {
 /**
@@ -138,6 +163,448 @@ TEST(visitor, basic_demo) {
   delete visitor2;
 }
 
+namespace variant_visitor {
+/**
+ * The same structure without the double virtual dispatch. The components are
+ * plain value types with no common base, and a collection of them is a
+ * std::vector of std::variant, so they sit contiguously instead of behind one
+ * heap pointer each.
+ */
+class ConcreteComponentA {
+public:
+  [[nodiscard]] std::string ExclusiveMethodOfConcreteComponentA() const {
+    return "A";
+  }
+};
+
+class ConcreteComponentB {
+public:
+  [[nodiscard]] std::string SpecialMethodOfConcreteComponentB() const {
+    return "B";
+  }
+};
+
+using Component = std::variant<ConcreteComponentA, ConcreteComponentB>;
+
+/**
+ * A visitor is any overload set with one call operator per component type.
+ * `overloaded` builds one out of lambdas; a plain struct with several
+ * operator() works just as well.
+ */
+template <class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
+template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+struct ConcreteVisitor1 {
+  void operator()(const ConcreteComponentA &element) const {
+    std::cout << element.ExclusiveMethodOfConcreteComponentA() << " + ConcreteVisitor1\n";
+  }
+
+  void operator()(const ConcreteComponentB &element) const {
+    std::cout << element.SpecialMethodOfConcreteComponentB() << " + ConcreteVisitor1\n";
+  }
+};
+
+/**
+ * std::visit resolves the overload at compile time and dispatches on the
+ * variant index through a generated jump table: one indirect branch per
+ * element instead of two virtual calls.
+ */
+template <typename Visitor>
+void ClientCode(const std::vector<Component> &components, Visitor &&visitor) {
+  for (const auto &comp : components)
+    std::visit(visitor, comp);
+}
+
+} // end of namespace variant_visitor
+
+TEST(visitor, variant_demo) {
+  using namespace variant_visitor;
+
+  std::vector<Component> components{ConcreteComponentA{}, ConcreteComponentB{}};
+
+  std::stringstream oss;
+  testing::internal::CaptureStdout();
+
+  ClientCode(components, ConcreteVisitor1{});
+  ClientCode(components, overloaded{
+      [](const ConcreteComponentA &a) {
+        std::cout << a.ExclusiveMethodOfConcreteComponentA() << " + ConcreteVisitor2\n";
+      },
+      [](const ConcreteComponentB &b) {
+        std::cout << b.SpecialMethodOfConcreteComponentB() << " + ConcreteVisitor2\n";
+      }});
+
+  oss << "A + ConcreteVisitor1\n"
+         "B + ConcreteVisitor1\n"
+         "A + ConcreteVisitor2\n"
+         "B + ConcreteVisitor2\n";
+
+  EXPECT_EQ(oss.str(), testing::internal::GetCapturedStdout());
+}
+
+TEST(visitor, variant_dispatch_benchmark) {
+  constexpr size_t count = 10'000'000;
+
+  // Counts how many of each kind it sees; cheap enough that the dispatch
+  // itself is what gets measured.
+  struct CountingVisitor : visitor::Visitor {
+    mutable size_t a = 0, b = 0;
+    void VisitConcreteComponentA(const visitor::ConcreteComponentA *) const override { ++a; }
+    void VisitConcreteComponentB(const visitor::ConcreteComponentB *) const override { ++b; }
+  };
+
+  std::mt19937 rng(42);
+  std::bernoulli_distribution coin(0.5);
+  std::vector<bool> is_a(count);
+  for (size_t i = 0; i < count; ++i)
+    is_a[i] = coin(rng);
+
+  std::vector<std::unique_ptr<visitor::Component>> heap_components;
+  std::vector<variant_visitor::Component> variant_components;
+  heap_components.reserve(count);
+  variant_components.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (is_a[i]) {
+      heap_components.emplace_back(std::make_unique<visitor::ConcreteComponentA>());
+      variant_components.emplace_back(variant_visitor::ConcreteComponentA{});
+    } else {
+      heap_components.emplace_back(std::make_unique<visitor::ConcreteComponentB>());
+      variant_components.emplace_back(variant_visitor::ConcreteComponentB{});
+    }
+  }
+
+  CountingVisitor virtual_counts;
+  auto start = std::chrono::steady_clock::now();
+  for (const auto &comp : heap_components)
+    comp->Accept(&virtual_counts);
+  auto virtual_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  size_t a = 0, b = 0;
+  start = std::chrono::steady_clock::now();
+  variant_visitor::ClientCode(variant_components, variant_visitor::overloaded{
+      [&a](const variant_visitor::ConcreteComponentA &) { ++a; },
+      [&b](const variant_visitor::ConcreteComponentB &) { ++b; }});
+  auto variant_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  EXPECT_EQ(virtual_counts.a, a);
+  EXPECT_EQ(virtual_counts.b, b);
+  EXPECT_EQ(a + b, count);
+
+  std::cout << "visiting " << count << " mixed components:\n"
+            << "  double virtual dispatch: " << virtual_time.count() * 1e3 << " ms\n"
+            << "  std::variant + std::visit: " << variant_time.count() * 1e3 << " ms\n";
+}
+
+namespace archetype_visitor {
+/**
+ * Even with std::visit, a randomly interleaved mix of component types sends
+ * the dispatch branch a different way on every element, which the branch
+ * predictor cannot learn. ArchetypeStore keeps one contiguous array per
+ * concrete type instead, so `Visit` runs one tight homogeneous loop per type
+ * with no dispatch at all.
+ *
+ * `Add` hands back a stable Id. Callers that care about insertion order (or
+ * need to find one particular component again) go through the Id table,
+ * which records the type and the slot inside that type's array. The Id also
+ * carries the type it was added as, so `Get<T>` with the wrong T throws
+ * instead of handing back some other component's slot.
+ */
+template <typename... Components>
+class ArchetypeStore {
+public:
+  struct Id {
+    uint32_t index;
+    uint8_t type;
+  };
+
+  template <typename T>
+  Id Add(T component) {
+    static_assert((std::is_same_v<T, Components> || ...), "not a component of this store");
+
+    auto &column = std::get<std::vector<T>>(columns_);
+    ids_.push_back({TypeIndex<T>(), static_cast<uint32_t>(column.size())});
+    column.push_back(std::move(component));
+    return {static_cast<uint32_t>(ids_.size() - 1), TypeIndex<T>()};
+  }
+
+  template <typename T>
+  T &Get(Id id) {
+    static_assert((std::is_same_v<T, Components> || ...), "not a component of this store");
+
+    if (id.index >= ids_.size())
+      throw std::out_of_range("ArchetypeStore: unknown id");
+    if (id.type != TypeIndex<T>() || ids_[id.index].type != id.type)
+      throw std::invalid_argument("ArchetypeStore: id does not refer to this component type");
+    return std::get<std::vector<T>>(columns_)[ids_[id.index].slot];
+  }
+
+  [[nodiscard]] size_t size() const { return ids_.size(); }
+
+  // Type by type: all of the first component type, then all of the next...
+  template <typename Visitor>
+  void Visit(Visitor &&visitor) const {
+    (VisitColumn<Components>(visitor), ...);
+  }
+
+  // Original insertion order, at the cost of a dispatch per element.
+  template <typename Visitor>
+  void VisitInOrder(Visitor &&visitor) const {
+    for (const auto &loc : ids_)
+      VisitOne<0, Components...>(visitor, loc);
+  }
+
+private:
+  struct Location {
+    uint8_t type;
+    uint32_t slot;
+  };
+
+  template <typename T>
+  static constexpr uint8_t TypeIndex() {
+    uint8_t i = 0;
+    ((std::is_same_v<T, Components> ? false : (++i, true)) && ...);
+    return i;
+  }
+
+  template <typename T, typename Visitor>
+  void VisitColumn(Visitor &visitor) const {
+    for (const auto &c : std::get<std::vector<T>>(columns_))
+      visitor(c);
+  }
+
+  template <size_t I, typename T, typename... Rest, typename Visitor>
+  void VisitOne(Visitor &visitor, const Location &loc) const {
+    if (loc.type == I)
+      visitor(std::get<std::vector<T>>(columns_)[loc.slot]);
+    else if constexpr (sizeof...(Rest) > 0)
+      VisitOne<I + 1, Rest...>(visitor, loc);
+  }
+
+  std::tuple<std::vector<Components>...> columns_;
+  std::vector<Location> ids_;
+};
+
+} // end of namespace archetype_visitor
+
+TEST(visitor, archetype_demo) {
+  using namespace variant_visitor;
+  archetype_visitor::ArchetypeStore<ConcreteComponentA, ConcreteComponentB> store;
+
+  store.Add(ConcreteComponentB{});
+  auto a = store.Add(ConcreteComponentA{});
+  store.Add(ConcreteComponentB{});
+
+  EXPECT_NO_THROW(store.Get<ConcreteComponentA>(a));
+  EXPECT_THROW(store.Get<ConcreteComponentB>(a), std::invalid_argument);
+  EXPECT_THROW(store.Get<ConcreteComponentA>({7, a.type}), std::out_of_range);
+
+  std::stringstream oss;
+  testing::internal::CaptureStdout();
+
+  store.Visit(ConcreteVisitor1{});
+  store.VisitInOrder(ConcreteVisitor1{});
+
+  oss << "A + ConcreteVisitor1\n"
+         "B + ConcreteVisitor1\n"
+         "B + ConcreteVisitor1\n"
+         "B + ConcreteVisitor1\n"
+         "A + ConcreteVisitor1\n"
+         "B + ConcreteVisitor1\n";
+
+  EXPECT_EQ(oss.str(), testing::internal::GetCapturedStdout());
+}
+
+TEST(visitor, archetype_benchmark) {
+  using namespace variant_visitor;
+  constexpr size_t count = 10'000'000;
+
+  // Components with a little payload so each type's work is distinct.
+  struct Particle { uint32_t mass; };
+  struct Spring { uint32_t stiffness; };
+
+  std::mt19937 rng(7);
+  std::vector<std::variant<Particle, Spring>> mixed;
+  archetype_visitor::ArchetypeStore<Particle, Spring> store;
+  mixed.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto v = static_cast<uint32_t>(rng());
+    if (v & 1) {
+      mixed.emplace_back(Particle{v});
+      store.Add(Particle{v});
+    } else {
+      mixed.emplace_back(Spring{v});
+      store.Add(Spring{v});
+    }
+  }
+
+  auto run = [](auto &&traverse) {
+    uint64_t mass = 0, stiffness = 0;
+    traverse(overloaded{
+        [&mass](const Particle &p) { mass += p.mass; },
+        [&stiffness](const Spring &s) { stiffness ^= s.stiffness * 3u; }});
+    return std::pair{mass, stiffness};
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  auto interleaved = run([&](auto &&v) {
+    for (const auto &c : mixed)
+      std::visit(v, c);
+  });
+  auto interleaved_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  auto sorted = run([&](auto &&v) { store.Visit(v); });
+  auto sorted_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  auto in_order = run([&](auto &&v) { store.VisitInOrder(v); });
+  auto in_order_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  EXPECT_EQ(interleaved, sorted);
+  EXPECT_EQ(interleaved, in_order);
+
+  std::cout << "visiting " << count << " randomly interleaved components:\n"
+            << "  interleaved std::visit: " << interleaved_time.count() * 1e3 << " ms\n"
+            << "  archetype store, by type: " << sorted_time.count() * 1e3 << " ms ("
+            << interleaved_time / sorted_time << "x)\n"
+            << "  archetype store, in order: " << in_order_time.count() * 1e3 << " ms\n";
+}
+
+namespace fused_visitor {
+/**
+ * Running ClientCode once per visitor walks the whole component collection
+ * once per visitor. When the collection is much larger than the cache, every
+ * walk streams it in from memory again. FusedVisitor is itself a Visitor that
+ * forwards each element to several visitors in turn, so one traversal serves
+ * all of them while the element is still in cache. Each visitor is a separate
+ * object and keeps its own state.
+ */
+class FusedVisitor : public visitor::Visitor {
+public:
+  FusedVisitor(std::initializer_list<const visitor::Visitor *> visitors)
+    : visitors_(visitors) {}
+
+  void VisitConcreteComponentA(const visitor::ConcreteComponentA *element) const override {
+    for (const auto *v : visitors_)
+      v->VisitConcreteComponentA(element);
+  }
+
+  void VisitConcreteComponentB(const visitor::ConcreteComponentB *element) const override {
+    for (const auto *v : visitors_)
+      v->VisitConcreteComponentB(element);
+  }
+
+private:
+  std::vector<const visitor::Visitor *> visitors_;
+};
+
+/**
+ * The same for overload-set visitors: Fuse(v1, v2, ...) is a single visitor
+ * that applies every one of them, in order, to each element. The visitors
+ * are held by reference so their state is observable afterwards.
+ */
+template <typename... Visitors>
+auto Fuse(Visitors &...visitors) {
+  return [&visitors...](const auto &element) { (visitors(element), ...); };
+}
+
+} // end of namespace fused_visitor
+
+TEST(visitor, fused_demo) {
+  using namespace visitor;
+
+  std::array<const Component *, 2> components = {new ConcreteComponentA, new ConcreteComponentB};
+  ConcreteVisitor1 visitor1;
+  ConcreteVisitor2 visitor2;
+  fused_visitor::FusedVisitor both{&visitor1, &visitor2};
+
+  std::stringstream oss;
+  testing::internal::CaptureStdout();
+
+  ClientCode(components, &both);
+
+  oss << "A + ConcreteVisitor1\n"
+         "A + ConcreteVisitor2\n"
+         "B + ConcreteVisitor1\n"
+         "B + ConcreteVisitor2\n";
+
+  EXPECT_EQ(oss.str(), testing::internal::GetCapturedStdout());
+
+  for (const Component *comp : components)
+    delete comp;
+}
+
+TEST(visitor, fused_benchmark) {
+  using variant_visitor::overloaded;
+  constexpr size_t count = 1 << 20;
+
+  // A cache-line-aligned payload per component makes the collection
+  // (128 MiB) far larger than the cache, so every traversal is bound by
+  // memory bandwidth.
+  struct alignas(64) Body { uint32_t values[15]; };
+  struct alignas(64) Joint { uint32_t values[15]; };
+
+  std::mt19937 rng(3);
+  std::vector<std::variant<Body, Joint>> components;
+  components.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto v = static_cast<uint32_t>(rng());
+    if (v & 1)
+      components.emplace_back(Body{{v, v + 1, v + 2}});
+    else
+      components.emplace_back(Joint{{v, v * 2, v * 3}});
+  }
+
+  // Three independent visitors, each with its own accumulator.
+  struct Sum {
+    uint64_t total = 0;
+    void operator()(const Body &b) { total += b.values[0]; }
+    void operator()(const Joint &j) { total += j.values[1]; }
+  };
+  struct Xor {
+    uint64_t total = 0;
+    void operator()(const Body &b) { total ^= b.values[1]; }
+    void operator()(const Joint &j) { total ^= j.values[2]; }
+  };
+  struct Count {
+    uint64_t bodies = 0;
+    void operator()(const Body &) { ++bodies; }
+    void operator()(const Joint &) {}
+  };
+
+  auto traverse = [&components](auto &&visitor) {
+    for (const auto &c : components)
+      std::visit(visitor, c);
+  };
+
+  Sum sum1;
+  Xor xor1;
+  Count count1;
+  auto start = std::chrono::steady_clock::now();
+  traverse(sum1);
+  traverse(xor1);
+  traverse(count1);
+  auto separate_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  Sum sum2;
+  Xor xor2;
+  Count count2;
+  start = std::chrono::steady_clock::now();
+  traverse(fused_visitor::Fuse(sum2, xor2, count2));
+  auto fused_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+  EXPECT_EQ(sum1.total, sum2.total);
+  EXPECT_EQ(xor1.total, xor2.total);
+  EXPECT_EQ(count1.bodies, count2.bodies);
+
+  auto mib = static_cast<double>(components.size() * sizeof(components[0])) / (1 << 20);
+  std::cout << "3 visitors over " << mib << " MiB of components:\n"
+            << "  separate traversals: " << 3 * mib << " MiB read, "
+            << separate_time.count() * 1e3 << " ms\n"
+            << "  fused traversal: " << mib << " MiB read, "
+            << fused_time.count() * 1e3 << " ms\n";
+}
+
 namespace visitor_factory {
 
 class ResourceFile {
@@ -149,7 +616,9 @@ public:
 
 public:
   explicit ResourceFile(std::string file_path) : file_path_(std::move(file_path)) {}
+  virtual ~ResourceFile() = default;
   [[nodiscard]] virtual ResourceFileType getType() const = 0;
+  [[nodiscard]] const std::string &path() const { return file_path_; }
 };
 
 class PdfFile : public ResourceFile {
@@ -176,9 +645,45 @@ public:
   }
 };
 
+/**
+ * Where extractors put the text they pull out of a file. The pipeline below
+ * hands each worker a buffered writer, so extractors never hold a whole
+ * document's text in memory.
+ */
+class TextOutput {
+public:
+  virtual ~TextOutput() = default;
+  virtual void append(std::string_view text) = 0;
+};
+
 class Extractor {
 public:
+  virtual ~Extractor() = default;
   virtual void extract2txt(ResourceFile &res_file) = 0;
+
+  /**
+   * Extract the text of a file whose raw bytes are `content`. Must be safe to
+   * call from several threads at once.
+   */
+  virtual void extract2txt(std::string_view content, TextOutput &out) const = 0;
+
+protected:
+  // Emits every run of at least `min_run` printable ASCII characters, one
+  // per line, much like strings(1).
+  static void extractPrintableRuns(std::string_view content, TextOutput &out,
+                                   size_t min_run = 4) {
+    size_t start = 0;
+    for (size_t i = 0; i <= content.size(); ++i) {
+      bool printable = i < content.size() && content[i] >= 0x20 && content[i] < 0x7f;
+      if (printable)
+        continue;
+      if (i - start >= min_run) {
+        out.append(content.substr(start, i - start));
+        out.append("\n");
+      }
+      start = i + 1;
+    }
+  }
 };
 
 class PdfExtractor : public Extractor {
@@ -186,6 +691,21 @@ public:
   void extract2txt(ResourceFile &res_file) override {
     std::cout << "pdf extractor.\n";
   }
+
+  // Text in a PDF content stream is shown from literal strings: "(...) Tj".
+  void extract2txt(std::string_view content, TextOutput &out) const override {
+    size_t pos = 0;
+    while ((pos = content.find('(', pos)) != std::string_view::npos) {
+      size_t end = pos + 1;
+      while (end < content.size() && content[end] != ')')
+        end += content[end] == '\\' ? 2 : 1;
+      if (end >= content.size())
+        break;
+      out.append(content.substr(pos + 1, end - pos - 1));
+      out.append("\n");
+      pos = end + 1;
+    }
+  }
 };
 
 class PPTExtractor : public Extractor {
@@ -193,6 +713,10 @@ public:
   void extract2txt(ResourceFile &res_file) override {
     std::cout << "PPT extractor.\n";
   }
+
+  void extract2txt(std::string_view content, TextOutput &out) const override {
+    extractPrintableRuns(content, out);
+  }
 };
 
 class WordExtractor : public Extractor {
@@ -200,21 +724,77 @@ public:
   void extract2txt(ResourceFile &res_file) override {
     std::cout << "word extractor.\n";
   }
+
+  void extract2txt(std::string_view content, TextOutput &out) const override {
+    extractPrintableRuns(content, out);
+  }
+};
+
+/**
+ * The registry is a flat array indexed by the uint8_t value of the file type,
+ * holding non-owning pointers, so a lookup is one load with no hashing and no
+ * reference count to bump. Extractors are registered during startup; once
+ * `freeze()` is called the table is read-only and further registration is
+ * rejected. Registered extractors must outlive every lookup (the built-in ones
+ * are static).
+ *
+ * Every registry starts out with the built-in extractors. ExtractorFactory
+ * forwards to the process-wide one; tests build their own.
+ */
+class ExtractorRegistry {
+  using ResourceFileType = ResourceFile::ResourceFileType;
+  static constexpr size_t kMaxTypes = 256;
+
+  inline static PdfExtractor pdf_extractor_;
+  inline static PPTExtractor ppt_extractor_;
+  inline static WordExtractor word_extractor_;
+
+  // Indexed by ResourceFileType: PDF, PPT, WORD, then anything registered.
+  std::atomic<Extractor *> registry_[kMaxTypes] = {
+      &pdf_extractor_, &ppt_extractor_, &word_extractor_};
+
+  std::mutex registration_mutex_;
+  std::atomic<bool> frozen_{false};
+
+public:
+  Extractor *getExtractor(ResourceFileType type) const {
+    Extractor *extractor = registry_[static_cast<uint8_t>(type)].load(std::memory_order_acquire);
+    if (!extractor)
+      throw std::out_of_range("no extractor registered for this file type");
+    return extractor;
+  }
+
+  void registerExtractor(ResourceFileType type, Extractor *extractor) {
+    std::lock_guard<std::mutex> lock(registration_mutex_);
+    if (frozen_.load(std::memory_order_relaxed))
+      throw std::logic_error("ExtractorFactory is frozen");
+    registry_[static_cast<uint8_t>(type)].store(extractor, std::memory_order_release);
+  }
+
+  void freeze() {
+    std::lock_guard<std::mutex> lock(registration_mutex_);
+    frozen_.store(true, std::memory_order_relaxed);
+  }
+
+  bool frozen() const { return frozen_.load(std::memory_order_relaxed); }
 };
 
 class ExtractorFactory {
 private:
-  using ExtractorMap = std::unordered_map<ResourceFile::ResourceFileType, std::shared_ptr<Extractor>>;
-  inline static ExtractorMap maps_ = {
-      {ResourceFile::ResourceFileType::PDF,std::make_shared<PdfExtractor>(PdfExtractor{})},
-      {ResourceFile::ResourceFileType::PPT, std::make_shared<PPTExtractor>(PPTExtractor{})},
-      {ResourceFile::ResourceFileType::WORD, std::make_shared<WordExtractor>(WordExtractor{})}
-  };
+  using ResourceFileType = ResourceFile::ResourceFileType;
+
+  inline static ExtractorRegistry registry_;
 
 public:
-  static std::shared_ptr<Extractor> &getExtractor(ResourceFile::ResourceFileType type) {
-    return maps_.at(type);
+  static Extractor *getExtractor(ResourceFileType type) { return registry_.getExtractor(type); }
+
+  static void registerExtractor(ResourceFileType type, Extractor *extractor) {
+    registry_.registerExtractor(type, extractor);
   }
+
+  static void freeze() { registry_.freeze(); }
+
+  static bool frozen() { return registry_.frozen(); }
 };
 
 }
@@ -228,7 +808,538 @@ TEST(visitor, visitor_factory_demo) {
   res_files.emplace_back(std::make_shared<WordFile>(WordFile{"word"}));
 
   for (auto &res : res_files) {
-    auto &extractor = ExtractorFactory::getExtractor(res->getType());
+    auto *extractor = ExtractorFactory::getExtractor(res->getType());
     extractor->extract2txt(*res);
   }
-}
\ No newline at end of file
+}
+
+namespace visitor_factory {
+/**
+ * A streaming extraction pipeline built around ExtractorFactory:
+ *
+ *   scan directory --> bounded queue --> N workers --> StreamingSink --> fd
+ *
+ * The scanner only produces paths, the queue between it and the workers has a
+ * fixed capacity, files are read through read-only mappings (no copy into a
+ * userspace buffer), and every worker writes through a fixed-size buffer. So
+ * memory use depends on the thread count and buffer sizes, never on how many
+ * files the corpus holds.
+ */
+
+std::unique_ptr<ResourceFile> MakeResourceFile(const std::filesystem::path &path) {
+  auto ext = path.extension().string();
+  for (auto &c : ext)
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+  if (ext == ".pdf")
+    return std::make_unique<PdfFile>(path.string());
+  if (ext == ".ppt" || ext == ".pptx")
+    return std::make_unique<PPTFile>(path.string());
+  if (ext == ".doc" || ext == ".docx")
+    return std::make_unique<WordFile>(path.string());
+  return nullptr;
+}
+
+/**
+ * Read-only view of a whole file via mmap. An empty file yields an empty
+ * view; a file that cannot be opened or mapped throws std::system_error.
+ */
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "open " + path);
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "fstat " + path);
+    }
+    if (st.st_size > 0) {
+      void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap " + path);
+      }
+      ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(p);
+      size_ = static_cast<size_t>(st.st_size);
+    }
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (data_)
+      ::munmap(const_cast<char *>(data_), size_);
+  }
+
+  [[nodiscard]] std::string_view view() const { return {data_, size_}; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+    items_.push(std::move(item));
+    not_empty_.notify_one();
+  }
+
+  // Blocks until an item is available; empty once closed and drained.
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+    if (items_.empty())
+      return std::nullopt;
+    T item = std::move(items_.front());
+    items_.pop();
+    not_full_.notify_one();
+    return item;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+private:
+  const size_t capacity_;
+  std::queue<T> items_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_empty_, not_full_;
+};
+
+/**
+ * Serializes text records from many workers onto one file descriptor. Each
+ * worker owns a Writer with a fixed-size buffer; a record that fits in the
+ * buffer is written in one go when it ends. A record that overflows it takes
+ * the sink for the rest of the record, so records never interleave.
+ */
+class StreamingSink {
+public:
+  explicit StreamingSink(int fd) : fd_(fd) {}
+
+  class Writer : public TextOutput {
+  public:
+    Writer(StreamingSink &sink, size_t capacity) : sink_(sink), capacity_(capacity) {
+      buffer_.reserve(capacity);
+    }
+
+    void append(std::string_view text) override {
+      if (buffer_.size() + text.size() <= capacity_) {
+        buffer_.append(text);
+        return;
+      }
+
+      if (!held_.owns_lock())
+        held_ = std::unique_lock<std::mutex>(sink_.mutex_);
+      sink_.writeAll(buffer_);
+      buffer_.clear();
+      if (text.size() > capacity_)
+        sink_.writeAll(text);
+      else
+        buffer_.append(text);
+    }
+
+    void endRecord() {
+      if (!held_.owns_lock())
+        held_ = std::unique_lock<std::mutex>(sink_.mutex_);
+      sink_.writeAll(buffer_);
+      buffer_.clear();
+      held_.unlock();
+    }
+
+    // Drops a record that failed half way, releasing the sink if held.
+    void abandonRecord() {
+      buffer_.clear();
+      if (held_.owns_lock())
+        held_.unlock();
+    }
+
+  private:
+    StreamingSink &sink_;
+    const size_t capacity_;
+    std::string buffer_;
+    std::unique_lock<std::mutex> held_;
+  };
+
+  [[nodiscard]] size_t bytesWritten() const { return bytes_written_; }
+
+private:
+  void writeAll(std::string_view data) {
+    while (!data.empty()) {
+      ssize_t n = ::write(fd_, data.data(), data.size());
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::system_error(errno, std::generic_category(), "write");
+      }
+      data.remove_prefix(static_cast<size_t>(n));
+      bytes_written_ += static_cast<size_t>(n);
+    }
+  }
+
+  int fd_;
+  std::mutex mutex_;
+  size_t bytes_written_ = 0;
+};
+
+/**
+ * Anonymous resident memory (heap, stacks, buffers). File-backed pages, such
+ * as those of the input mappings, are left out: the kernel can drop them at
+ * any time, and counting them would make the figure track the page cache
+ * rather than what the pipeline itself holds.
+ */
+size_t AnonymousResidentBytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0, file_backed = 0;
+  statm >> pages >> resident >> file_backed;
+  return (resident - std::min(resident, file_backed)) * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * Samples AnonymousResidentBytes() on its own thread every millisecond until
+ * destroyed, so short-lived peaks between files are not missed.
+ */
+class PeakMemorySampler {
+public:
+  PeakMemorySampler() : base_(AnonymousResidentBytes()), peak_(base_) {
+    thread_ = std::thread([this] {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!stop_) {
+        peak_ = std::max(peak_, AnonymousResidentBytes());
+        wake_.wait_for(lock, std::chrono::milliseconds(1));
+      }
+    });
+  }
+
+  PeakMemorySampler(const PeakMemorySampler &) = delete;
+  PeakMemorySampler &operator=(const PeakMemorySampler &) = delete;
+
+  ~PeakMemorySampler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  // Bytes above the level at construction.
+  [[nodiscard]] size_t growth() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peak_ = std::max(peak_, AnonymousResidentBytes());
+    return peak_ - std::min(peak_, base_);
+  }
+
+private:
+  const size_t base_;
+  size_t peak_;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+};
+
+struct ExtractionStats {
+  size_t files = 0;
+  size_t bytes_read = 0;
+  size_t bytes_written = 0;
+  double seconds = 0;
+  size_t peak_memory_growth = 0; // anonymous RSS above the level at the start of Run
+};
+
+class ExtractionPipeline {
+public:
+  explicit ExtractionPipeline(size_t threads, size_t queue_capacity = 1024,
+                              size_t writer_buffer = 64 * 1024)
+    : threads_(threads ? threads : 1), queue_capacity_(queue_capacity),
+      writer_buffer_(writer_buffer) {}
+
+  ExtractionStats Run(const std::filesystem::path &root, int out_fd) {
+    ExtractionStats stats;
+    auto start = std::chrono::steady_clock::now();
+    PeakMemorySampler memory;
+
+    BoundedQueue<std::unique_ptr<ResourceFile>> queue(queue_capacity_);
+    StreamingSink sink(out_fd);
+    std::atomic<size_t> files{0}, bytes_read{0};
+
+    // The first failure from any thread; rethrown once everything has joined.
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+    auto fail = [&](std::exception_ptr e) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+        error = std::move(e);
+      failed = true;
+    };
+
+    // Closes the queue and joins the workers on every way out of the scope.
+    struct Shutdown {
+      BoundedQueue<std::unique_ptr<ResourceFile>> &queue;
+      std::vector<std::thread> &workers;
+      ~Shutdown() {
+        queue.close();
+        for (auto &t : workers)
+          if (t.joinable())
+            t.join();
+      }
+    };
+
+    std::vector<std::thread> workers;
+    {
+      Shutdown shutdown{queue, workers};
+      for (size_t i = 0; i < threads_; ++i) {
+        workers.emplace_back([&] {
+          StreamingSink::Writer writer(sink, writer_buffer_);
+          while (auto res = queue.pop()) {
+            if (failed.load(std::memory_order_relaxed))
+              continue; // keep draining so the producer never blocks
+            try {
+              MappedFile file((*res)->path());
+              const auto *extractor = ExtractorFactory::getExtractor((*res)->getType());
+
+              writer.append("== ");
+              writer.append((*res)->path());
+              writer.append(" ==\n");
+              extractor->extract2txt(file.view(), writer);
+              writer.endRecord();
+
+              files.fetch_add(1, std::memory_order_relaxed);
+              bytes_read.fetch_add(file.view().size(), std::memory_order_relaxed);
+            } catch (...) {
+              writer.abandonRecord();
+              fail(std::current_exception());
+            }
+          }
+        });
+      }
+
+      try {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+          if (failed.load(std::memory_order_relaxed))
+            break;
+          std::error_code type_ec; // an entry that vanished mid-scan is skipped
+          if (!it->is_regular_file(type_ec))
+            continue;
+          if (auto res = MakeResourceFile(it->path()))
+            queue.push(std::move(res));
+        }
+        if (ec)
+          throw fs::filesystem_error("ExtractionPipeline", root, ec);
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    }
+    if (error)
+      std::rethrow_exception(error);
+
+    stats.files = files;
+    stats.bytes_read = bytes_read;
+    stats.bytes_written = sink.bytesWritten();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.peak_memory_growth = memory.growth();
+    return stats;
+  }
+
+private:
+  size_t threads_;
+  size_t queue_capacity_;
+  size_t writer_buffer_;
+};
+
+} // end of namespace visitor_factory
+
+TEST(visitor, extractor_registry_demo) {
+  using namespace visitor_factory;
+  using ResourceFileType = ResourceFile::ResourceFileType;
+
+  // A new file type registered at startup, before the registry is frozen.
+  struct MarkdownExtractor : Extractor {
+    void extract2txt(ResourceFile &) override { std::cout << "markdown extractor.\n"; }
+    void extract2txt(std::string_view content, TextOutput &out) const override {
+      out.append(content);
+    }
+  };
+  MarkdownExtractor markdown_extractor;
+  constexpr auto markdown = static_cast<ResourceFileType>(200);
+
+  // A registry of its own, so the process-wide one stays untouched.
+  ExtractorRegistry registry;
+  EXPECT_THROW(registry.getExtractor(markdown), std::out_of_range);
+  registry.registerExtractor(markdown, &markdown_extractor);
+  EXPECT_FALSE(registry.frozen());
+  registry.freeze();
+
+  EXPECT_EQ(registry.getExtractor(markdown), &markdown_extractor);
+  EXPECT_EQ(registry.getExtractor(ResourceFileType::PDF),
+            ExtractorFactory::getExtractor(ResourceFileType::PDF));
+  EXPECT_THROW(registry.registerExtractor(markdown, nullptr), std::logic_error);
+  EXPECT_THROW(ExtractorFactory::getExtractor(markdown), std::out_of_range);
+}
+
+TEST(visitor, extractor_registry_benchmark) {
+  using namespace visitor_factory;
+  using ResourceFileType = ResourceFile::ResourceFileType;
+
+  constexpr size_t lookups = 4'000'000;
+  constexpr size_t thread_count = 4;
+  const ResourceFileType types[] = {ResourceFileType::PDF, ResourceFileType::PPT,
+                                    ResourceFileType::WORD};
+
+  // The previous design: hash into a map of shared_ptr, and have each caller
+  // hold its own copy, which bumps the shared control block every time.
+  std::unordered_map<ResourceFileType, std::shared_ptr<Extractor>> legacy = {
+      {ResourceFileType::PDF, std::make_shared<PdfExtractor>()},
+      {ResourceFileType::PPT, std::make_shared<PPTExtractor>()},
+      {ResourceFileType::WORD, std::make_shared<WordExtractor>()}};
+
+  auto run = [&](auto &&lookup) {
+    std::atomic<uintptr_t> sink{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t] {
+        uintptr_t local = 0;
+        for (size_t i = 0; i < lookups; ++i)
+          local += lookup(types[(i + t) % 3]);
+        sink += local;
+      });
+    }
+    for (auto &th : threads)
+      th.join();
+    EXPECT_NE(sink.load(), 0u);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  };
+
+  auto shared_time = run([&legacy](ResourceFileType type) {
+    std::shared_ptr<Extractor> extractor = legacy.at(type);
+    return reinterpret_cast<uintptr_t>(extractor.get());
+  });
+  auto registry_time = run([](ResourceFileType type) {
+    return reinterpret_cast<uintptr_t>(ExtractorFactory::getExtractor(type));
+  });
+
+  auto total = static_cast<double>(lookups * thread_count);
+  std::cout << thread_count << " threads x " << lookups << " extractor lookups:\n"
+            << "  unordered_map + shared_ptr copy: " << shared_time.count() * 1e3 << " ms ("
+            << total / shared_time.count() / 1e6 << " M lookups/s)\n"
+            << "  flat registry: " << registry_time.count() * 1e3 << " ms ("
+            << total / registry_time.count() / 1e6 << " M lookups/s)\n";
+}
+
+namespace {
+
+// Writes `per_type` files of each extension under `root`, with `padding`
+// bytes of binary filler around the text in each.
+void MakeExtractionCorpus(const std::filesystem::path &root, int per_type, size_t padding) {
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "nested");
+  std::string filler(padding, '\0');
+
+  for (int i = 0; i < per_type; ++i) {
+    auto dir = (i % 2) ? root / "nested" : root;
+    std::ofstream(dir / ("doc" + std::to_string(i) + ".pdf"), std::ios::binary)
+        << filler << "BT (hello pdf " << i << ") Tj ET" << filler;
+    std::ofstream(dir / ("deck" + std::to_string(i) + ".pptx"), std::ios::binary)
+        << filler << "hello ppt " << i << filler;
+    std::ofstream(dir / ("note" + std::to_string(i) + ".docx"), std::ios::binary)
+        << filler << "hello word " << i << filler;
+    std::ofstream(dir / ("skip" + std::to_string(i) + ".bin"), std::ios::binary) << "ignored";
+  }
+}
+
+} // namespace
+
+TEST(visitor, extraction_pipeline_demo) {
+  using namespace visitor_factory;
+
+  auto root = std::filesystem::temp_directory_path() / "visitor_extraction_demo";
+  auto out_path = std::filesystem::temp_directory_path() / "visitor_extraction_demo.txt";
+  MakeExtractionCorpus(root, 50, 16);
+
+  int fd = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  // A tiny writer buffer exercises the record-overflow path as well.
+  auto stats = ExtractionPipeline(4, 8, 32).Run(root, fd);
+  ::close(fd);
+
+  EXPECT_EQ(stats.files, 150u);
+
+  std::ifstream in(out_path);
+  std::string line, header;
+  size_t headers = 0;
+  std::vector<std::string> texts;
+  while (std::getline(in, line)) {
+    if (line.rfind("== ", 0) == 0) {
+      ++headers;
+      header = line;
+      continue;
+    }
+
+    // Every text line sits under the header of the file it came from.
+    texts.push_back(line);
+    auto ext = line.rfind("hello pdf", 0) == 0   ? ".pdf"
+               : line.rfind("hello ppt", 0) == 0 ? ".pptx"
+                                                 : ".docx";
+    EXPECT_NE(header.find(ext), std::string::npos) << line;
+  }
+  EXPECT_EQ(headers, 150u);
+  EXPECT_EQ(texts.size(), 150u);
+  EXPECT_NE(std::find(texts.begin(), texts.end(), "hello pdf 7"), texts.end());
+  EXPECT_NE(std::find(texts.begin(), texts.end(), "hello word 42"), texts.end());
+
+  // Failures on the worker threads come back out of Run instead of
+  // terminating: here every write to the invalid descriptor fails.
+  EXPECT_THROW(ExtractionPipeline(4, 8, 32).Run(root, -1), std::system_error);
+  EXPECT_THROW(ExtractionPipeline(2).Run(root / "missing", 1), std::filesystem::filesystem_error);
+  EXPECT_THROW(MappedFile((root / "missing.pdf").string()), std::system_error);
+
+  std::filesystem::remove_all(root);
+  std::filesystem::remove(out_path);
+}
+
+TEST(visitor, extraction_pipeline_benchmark) {
+  using namespace visitor_factory;
+
+  auto root = std::filesystem::temp_directory_path() / "visitor_extraction_bench";
+  // 100k resource files (plus a third as many skipped ones) of ~2 KiB each.
+  constexpr int per_type = 33'334;
+  MakeExtractionCorpus(root, per_type, 1024);
+
+  int fd = ::open("/dev/null", O_WRONLY);
+  ASSERT_GE(fd, 0);
+  size_t threads = std::max(2u, std::thread::hardware_concurrency());
+  auto stats = ExtractionPipeline(threads).Run(root, fd);
+  ::close(fd);
+
+  EXPECT_EQ(stats.files, 3u * per_type);
+  // Queue, writer buffers and thread stacks; nothing proportional to the corpus.
+  EXPECT_LT(stats.peak_memory_growth, 16u << 20);
+  std::cout << "extracted " << stats.files << " files (" << stats.bytes_read / (1 << 20)
+            << " MiB) with " << threads << " threads in " << stats.seconds * 1e3 << " ms: "
+            << stats.bytes_read / stats.seconds / (1 << 20) << " MiB/s, peak anonymous RSS growth "
+            << stats.peak_memory_growth / 1024 << " KiB\n";
+
+  std::filesystem::remove_all(root);
+}